@@ -1,54 +1,140 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <psp2/io/stat.h>
 #include <vector>
 #include <string>
 
-struct AppInfoIcon {
-    int pageId = 0;
-    int pageNo = 0;
-    int pos = 0;
-    char title[128] = {0};
-    char titleId[16] = {0};
-    char reserved01[16] = {0};
-    int icon0Type = 0; 
+// Every string loaded from app.db, stored back to back in one buffer and referenced by offset. Identical
+// strings (e.g. the many "(null)" titleIds and reserved01s) are only stored once.
+class StringPool {
+    public:
+        uint32_t Add(const char *str, uint32_t len);
+        void Reserve(uint32_t count, uint32_t bytes);
+        void Clear(void);
+        void Assign(std::vector<char> &&bytes);
+
+        const std::vector<char> &Data(void) const {
+            return data;
+        }
+
+        const char *Get(uint32_t offset) const {
+            return &data[offset];
+        }
+
+    private:
+        std::vector<char> data;
+        std::vector<uint32_t> slots; // Open addressing table of offset + 1, 0 marks an empty slot.
+        uint32_t count = 0;
+
+        void Grow(void);
 };
 
 struct AppInfoPage {
     int pageId = 0;
     int pageNo = 0;
+    int origPageNo = 0;
 };
 
 struct AppInfoFolder {
     int pageId = 0;
     int index = 0;
+    int pageNo = 0;          // Matches the reserved01 of the folder icon.
+    uint32_t begin = 0;      // Range of this folder's apps in AppEntries::children.
+    uint32_t end = 0;
 };
 
-// Info for an app that belongs to a parent folder.
-struct AppInfoChild {
+// Target position of an icon that has to be written back to app.db.
+struct AppIconChange {
+    int64_t rowid = 0;
     int pageId = 0;
-    int pageNo = 0;
     int pos = 0;
-    char title[128] = {0};
-    char titleId[16] = {0};
 };
 
+// Only the icons and pages whose position differs from what was loaded.
+struct AppChanges {
+    std::vector<AppIconChange> icons;
+    std::vector<AppInfoPage> pages;
+};
+
+// Progress of an apply running on a worker thread, read by the UI while it runs.
+struct AppProgress {
+    std::atomic<int64_t> bytes{0};      // Of the file currently being copied.
+    std::atomic<int64_t> totalBytes{0};
+    std::atomic<uint32_t> rows{0};      // Rows written to app.db.
+    std::atomic<uint32_t> totalRows{0};
+    std::atomic<bool> cancel{false};    // Set by the UI. Honoured until the transaction starts to commit.
+};
+
+// Ascending permutation for one SortBy mode, computed once per load. Titles sort by collation key, title IDs
+// by AppEntries::titleIdKey.
+struct AppSortKeys {
+    bool built = false;
+    std::vector<uint32_t> prefix;   // First 4 key bytes, big-endian, so most comparisons are one integer compare.
+    std::vector<uint32_t> offset;   // Offset of each icon's NUL terminated collation key in bytes.
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> sorted;   // Icon indices in ascending key order.
+    std::vector<uint32_t> rank;     // Position of each icon in sorted.
+};
+
+// Icons are stored as parallel arrays indexed by load order, so sorting and layout only touch the small fields
+// they need. Strings live in one pool and are referenced by offset.
 struct AppEntries {
-    std::vector<AppInfoIcon> icons;
+    std::vector<int> pageId;
+    std::vector<int> pageNo;
+    std::vector<int> pos;
+    std::vector<int> icon0Type; // 7 = folder
+    std::vector<int> origPageId; // Position as loaded from app.db, used to plan which icons actually moved.
+    std::vector<int> origPos;
+    std::vector<int> origPageNo;
+    std::vector<int64_t> rowid; // Row in tbl_appinfo_icon, used to address the icon when saving.
+    std::vector<uint32_t> title;
+    std::vector<uint32_t> titleId;
+    std::vector<uint32_t> reserved01;
+    std::vector<uint64_t> titleIdKey; // Packed titleId, see AppList::PackTitleId.
+    StringPool strings;
+
+    AppSortKeys keys[2]; // Indexed by SortBy.
+    std::vector<uint32_t> order; // Icon indices in display/sort order.
+    std::vector<uint32_t> children; // Icon indices of folder apps, one range per folder.
+    std::vector<int> folder; // Index in folders of the folder a folder icon opens, -1 for other icons.
     std::vector<AppInfoPage> pages;
     std::vector<AppInfoFolder> folders;
-    std::vector<AppInfoChild> child_apps;
+    SceIoStat stat; // app.db as it was when loaded, to tell whether it has to be read again.
+
+    uint32_t Size(void) const {
+        return static_cast<uint32_t>(pageId.size());
+    }
+
+    const char *Title(uint32_t index) const {
+        return strings.Get(title[index]);
+    }
+
+    const char *TitleId(uint32_t index) const {
+        return strings.Get(titleId[index]);
+    }
+
+    const char *Reserved01(uint32_t index) const {
+        return strings.Get(reserved01[index]);
+    }
 };
 
 namespace AppList {
+    constexpr uint64_t InvalidTitleId = UINT64_MAX;
+
+    uint64_t PackTitleId(const char *titleId);
     int Get(AppEntries &entries);
-    int Save(std::vector<AppInfoIcon> &entries);
-    int SavePages(std::vector<AppInfoPage> &entries);
-    bool SortAppAsc(const AppInfoIcon &entryA, const AppInfoIcon &entryB);
-    bool SortAppDesc(const AppInfoIcon &entryA, const AppInfoIcon &entryB);
-    bool SortChildAppAsc(const AppInfoChild &entryA, const AppInfoChild &entryB);
-    bool SortChildAppDesc(const AppInfoChild &entryA, const AppInfoChild &entryB);
+    void Reset(AppEntries &entries);
+    int Refresh(AppEntries &entries);
+    void Plan(const AppEntries &entries, AppChanges &changes);
+    int Save(const std::vector<AppIconChange> &changes, AppProgress *progress = nullptr);
+    int SavePages(const std::vector<AppInfoPage> &changes, AppProgress *progress = nullptr);
+    void Order(AppEntries &entries, int mode);
     void Sort(AppEntries &entries);
-    int Backup(void);
+    void Place(AppEntries &entries);
+    int Snapshot(std::vector<unsigned char> &data, AppProgress *progress = nullptr);
+    int Backup(AppProgress *progress = nullptr);
     int Restore(void);
     bool Compare(const std::string &db_name);
 }
@@ -5,6 +5,7 @@ typedef struct {
     int sort_by = 0;
     int sort_folders = 0;
     int sort_mode = 0;
+    int sort_placement = 0;
 } config_t;
 
 extern config_t cfg;
@@ -20,6 +21,17 @@ enum SortFolders {
     SortFoldersOnly
 };
 
+enum SortMode {
+    SortDefault,
+    SortAsc,
+    SortDesc
+};
+
+enum SortPlacement {
+    PlacementFull,
+    PlacementIncremental
+};
+
 namespace Config {
     int Save(config_t &config);
     int Load(void);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <psp2/io/dirent.h>
+#include <cstdint>
+#include <functional>
 #include <psp2/types.h>
 #include <string>
 #include <vector>
@@ -10,9 +12,28 @@ namespace FS {
     bool DirExists(const std::string &path);
     int CreateFile(const std::string &path);
     int MakeDir(const std::string &path);
+    int GetFileSize(const std::string &path, SceOff &size);
+    int ReadFile(const std::string &path, void *data, SceSize size);
     int WriteFile(const std::string &path, const void *data, SceSize size);
     int RemoveFile(const std::string &path);
-    int CopyFile(const std::string &src_path, const std::string &dest_path);
+    // Renames src_path over dest_path, keeping dest_path as dest_path.old until src_path is in place. src_path is
+    // removed if dest_path cannot be moved aside.
+    int ReplaceFile(const std::string &src_path, const std::string &dest_path);
+    // Renames path.old back to path if a ReplaceFile was interrupted after moving path aside.
+    int RecoverFile(const std::string &path);
+    // Called with the bytes copied so far and the file size, return false to stop the copy.
+    typedef std::function<bool(SceOff copied, SceOff size)> CopyProgress;
+
+    struct CopyStats {
+        bool crc = false;         // Set before copying to get the CRC-32 of the copied data in checksum.
+        SceOff bytes = 0;
+        SceUInt64 usec = 0;
+        SceUInt64 readStall = 0;  // Writer waited for the reader, reads were the bottleneck.
+        SceUInt64 writeStall = 0; // Reader waited for a free chunk, writes were the bottleneck.
+        uint32_t checksum = 0;
+    };
+
+    int CopyFile(const std::string &src_path, const std::string &dest_path, const CopyProgress &progress = nullptr, CopyStats *stats = nullptr);
     std::string GetFileExt(const std::string &filename);
     int GetDirList(const std::string &path, std::vector<SceIoDirent> &entries);
 }
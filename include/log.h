@@ -1,7 +1,8 @@
 #pragma once
 
 namespace Log {
-    int Init(void);
-    int Exit(void);
-    int Error(const char *format, ...);
+    void Init(void);
+    void Exit(void);
+    void Error(const char *format, ...);
+    void Info(const char *format, ...);
 }
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <psp2/types.h>
+#include <string>
+#include <vector>
+
+// Backups and loadouts are kept as manifests that list the hashes of their blocks, while the blocks themselves are
+// stored once in a shared pack. Consecutive snapshots of app.db only differ in a few pages, so each one only adds
+// the pages that changed.
+namespace Store {
+    // A file to keep in a manifest. It is restored to path.
+    struct File {
+        std::string path;
+        const unsigned char *data = nullptr;
+        SceOff size = 0;
+    };
+
+    bool IsManifest(const std::string &path);
+    int Write(const std::string &manifest_path, const std::vector<File> &files);
+    int Read(const std::string &manifest_path, const std::string &path, std::vector<unsigned char> &data);
+    int Restore(const std::string &manifest_path);
+    int Remove(const std::string &manifest_path);
+}
@@ -14,12 +14,6 @@ enum IconType {
     Trash
 };
 
-enum SortMode {
-    SortDefault,
-    SortAsc,
-    SortDesc
-};
-
 enum State {
     StateNone,
     StateConfirmSort,
@@ -29,7 +23,8 @@ enum State {
     StateWarning,
     StateDone,
     StateDelete,
-    StateError
+    StateError,
+    StateApplying
 };
 
 namespace Tabs {
@@ -1,7 +1,15 @@
 #include <algorithm>
+#include <climits>
+#include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <psp2/io/fcntl.h>
 #include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "applist.h"
 #include "config.h"
@@ -9,452 +17,1724 @@
 #include "log.h"
 #include "sqlite3.h"
 #include "power.h"
+#include "store.h"
 #include "utils.h"
 
+uint32_t StringPool::Add(const char *str, uint32_t len) {
+    if ((count + 1) * 4 > slots.size() * 3) {
+        this->Grow();
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ static_cast<unsigned char>(str[i])) * 16777619u;
+    }
+
+    const uint32_t mask = slots.size() - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (slots[i] == 0) {
+            uint32_t offset = data.size();
+            data.insert(data.end(), str, str + len);
+            data.push_back('\0');
+            slots[i] = offset + 1;
+            count++;
+            return offset;
+        }
+
+        // An entry shorter than str may be the last one in data, so make sure len + 1 bytes are there to compare.
+        const uint32_t offset = slots[i] - 1;
+        const char *entry = &data[offset];
+        if ((data.size() - offset > len) && (sceClibMemcmp(entry, str, len) == 0) && (entry[len] == '\0')) {
+            return offset;
+        }
+    }
+}
+
+void StringPool::Reserve(uint32_t count, uint32_t bytes) {
+    data.reserve(bytes);
+
+    while (slots.size() * 3 < count * 4) {
+        this->Grow();
+    }
+}
+
+void StringPool::Clear(void) {
+    data.clear();
+    std::fill(slots.begin(), slots.end(), 0);
+    count = 0;
+}
+
+// Takes over strings that were interned elsewhere (e.g. the catalog cache). Lookups start empty, so later Adds
+// are not deduplicated against them.
+void StringPool::Assign(std::vector<char> &&bytes) {
+    data = std::move(bytes);
+    std::fill(slots.begin(), slots.end(), 0);
+    count = 0;
+}
+
+void StringPool::Grow(void) {
+    std::vector<uint32_t> old = std::move(slots);
+    slots.assign(old.empty()? 64 : old.size() * 2, 0);
+    const uint32_t mask = slots.size() - 1;
+
+    for (uint32_t slot : old) {
+        if (slot == 0) {
+            continue;
+        }
+
+        const char *entry = &data[slot - 1];
+        uint32_t hash = 2166136261u;
+        for (; *entry != '\0'; entry++) {
+            hash = (hash ^ static_cast<unsigned char>(*entry)) * 16777619u;
+        }
+
+        uint32_t i = hash & mask;
+        while (slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+
+        slots[i] = slot;
+    }
+}
+
 namespace AppList {
-    int Get(AppEntries &entries) {
-        entries.icons.clear();
+    // Interns a text column. NULL is kept as "(null)", the way sceClibSnprintf used to print it.
+    static uint32_t AddText(StringPool &strings, sqlite3_stmt *stmt, int column) {
+        const char *text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+        int len = sqlite3_column_bytes(stmt, column);
+
+        if (!text) {
+            return strings.Add("(null)", 6);
+        }
+
+        return strings.Add(text, len);
+    }
+
+    // Title IDs are 9 characters of 0-9 and A-Z (PCSE00123, VITASHELL, NPXS10015). Each character takes 6 bits,
+    // in an order that matches strcmp, so packed IDs sort the same as the strings. Anything else, including
+    // "(null)" on folders, returns InvalidTitleId and has to be compared as a string.
+    uint64_t PackTitleId(const char *titleId) {
+        uint64_t key = 0;
+
+        for (int i = 0; i < 9; i++) {
+            char c = titleId[i];
+
+            if (c >= '0' && c <= '9') {
+                key = (key << 6) | (c - '0' + 1);
+            }
+            else if (c >= 'A' && c <= 'Z') {
+                key = (key << 6) | (c - 'A' + 11);
+            }
+            else {
+                return InvalidTitleId;
+            }
+        }
+
+        return (titleId[9] == '\0')? key : InvalidTitleId;
+    }
+
+    static void Clear(AppEntries &entries) {
+        entries.pageId.clear();
+        entries.pageNo.clear();
+        entries.pos.clear();
+        entries.icon0Type.clear();
+        entries.origPageId.clear();
+        entries.origPos.clear();
+        entries.origPageNo.clear();
+        entries.rowid.clear();
+        entries.title.clear();
+        entries.titleId.clear();
+        entries.reserved01.clear();
+        entries.titleIdKey.clear();
+        entries.strings.Clear();
+        entries.keys[SortTitle].built = false;
+        entries.keys[SortTitleID].built = false;
+        sceClibMemset(&entries.stat, 0, sizeof(SceIoStat));
+        entries.order.clear();
+        entries.children.clear();
+        entries.folder.clear();
         entries.pages.clear();
         entries.folders.clear();
-        entries.child_apps.clear();
+    }
+
+    static void Reserve(AppEntries &entries, uint32_t icons, uint32_t pages) {
+        entries.pageId.reserve(icons);
+        entries.pageNo.reserve(icons);
+        entries.pos.reserve(icons);
+        entries.icon0Type.reserve(icons);
+        entries.origPageId.reserve(icons);
+        entries.origPos.reserve(icons);
+        entries.origPageNo.reserve(icons);
+        entries.rowid.reserve(icons);
+        entries.title.reserve(icons);
+        entries.titleId.reserve(icons);
+        entries.titleIdKey.reserve(icons);
+        entries.reserved01.reserve(icons);
+        entries.strings.Reserve(icons * 2, icons * 48);
+        entries.order.reserve(icons);
+        entries.children.reserve(icons);
+        entries.folder.reserve(icons);
+        entries.pages.reserve(pages);
+    }
+
+    // Links each folder icon to its range of apps once per load. The icon's reserved01 holds the pageNo of the
+    // folder it opens.
+    static void IndexFolders(AppEntries &entries) {
+        std::unordered_map<int, int> folderIndexMap;
+        for (unsigned int i = 0; i < entries.folders.size(); i++) {
+            folderIndexMap[entries.folders[i].pageNo] = i;
+        }
+
+        for (uint32_t i = 0; i < entries.Size(); i++) {
+            int folder = -1;
+
+            if (entries.icon0Type[i] == 7) {
+                char *end = nullptr;
+                const char *reserved01 = entries.Reserved01(i);
+                long pageNo = std::strtol(reserved01, &end, 10);
+
+                std::unordered_map<int, int>::const_iterator it = folderIndexMap.find(pageNo);
+                if ((end != reserved01) && (it != folderIndexMap.end())) {
+                    folder = it->second;
+                }
+            }
+
+            entries.folder.push_back(folder);
+        }
+    }
+
+    static bool ReadCache(AppEntries &entries, const SceIoStat &stat);
+    static void WriteCache(AppEntries &entries);
+
+    int Get(AppEntries &entries) {
+        SceUInt64 start = sceKernelGetProcessTimeWide();
+        AppList::Clear(entries);
+
+        // Taken before reading, so a write that lands while loading shows up as a change on the next refresh.
+        SceIoStat stat;
+        if (R_FAILED(sceIoGetstat(db_path, &stat))) {
+            sceClibMemset(&stat, 0, sizeof(SceIoStat));
+        }
+
+        if (AppList::ReadCache(entries, stat)) {
+            entries.stat = stat;
+            Log::Info("AppList::Get: %u icons from cache in %llu us\n", entries.Size(), sceKernelGetProcessTimeWide() - start);
+            return 0;
+        }
+
+        SceUInt64 cache = sceKernelGetProcessTimeWide();
+
+        sqlite3 *db = nullptr;
+        int ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            return ret;
+        }
+
+        sqlite3_stmt *stmt = nullptr;
+        ret = sqlite3_prepare_v2(db, "SELECT (SELECT COUNT(*) FROM tbl_appinfo_icon), (SELECT COUNT(*) FROM tbl_appinfo_page);", -1, &stmt, nullptr);
+
+        if ((ret == SQLITE_OK) && (sqlite3_step(stmt) == SQLITE_ROW)) {
+            AppList::Reserve(entries, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+        }
+
+        sqlite3_finalize(stmt);
+        SceUInt64 open = sceKernelGetProcessTimeWide();
+
+        // Ordered by the (pageId, pos) primary key so the rows come back in a deterministic order straight from its
+        // index, and every page or folder shows up as a run of rows that share the same pageId.
+        const char query[] = "SELECT info_icon.pageId, info_page.pageNo, info_icon.pos, info_icon.title, info_icon.titleId, info_icon.reserved01, "
+            "info_icon.icon0Type, info_icon.rowid "
+            "FROM tbl_appinfo_icon info_icon "
+            "INNER JOIN tbl_appinfo_page info_page "
+            "ON info_icon.pageId = info_page.pageId "
+            "ORDER BY info_icon.pageId, info_icon.pos;";
+
+        ret = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_prepare_v2 failed: %s\n", sqlite3_errmsg(db));
+            sqlite3_close(db);
+            return ret;
+        }
+
+        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const uint32_t index = entries.Size();
+            const int pageId = sqlite3_column_int(stmt, 0);
+            const int pageNo = sqlite3_column_int(stmt, 1);
+            const int pos = sqlite3_column_int(stmt, 2);
+
+            entries.pageId.push_back(pageId);
+            entries.pageNo.push_back(pageNo);
+            entries.pos.push_back(pos);
+            entries.title.push_back(AppList::AddText(entries.strings, stmt, 3));
+            entries.titleId.push_back(AppList::AddText(entries.strings, stmt, 4));
+            entries.reserved01.push_back(AppList::AddText(entries.strings, stmt, 5));
+            entries.titleIdKey.push_back(AppList::PackTitleId(entries.strings.Get(entries.titleId.back())));
+            entries.icon0Type.push_back(sqlite3_column_int(stmt, 6));
+            entries.rowid.push_back(sqlite3_column_int64(stmt, 7));
+            entries.origPageId.push_back(pageId);
+            entries.origPos.push_back(pos);
+            entries.origPageNo.push_back(pageNo);
+            entries.order.push_back(index);
+
+            // First icon of a new page or folder.
+            if ((index == 0) || (entries.pageId[index - 1] != pageId)) {
+                if (pageNo >= 0) {
+                    entries.pages.push_back({ pageId, pageNo, pageNo });
+                }
+                else {
+                    const uint32_t begin = entries.children.size();
+                    entries.folders.push_back({ pageId, 0, pageNo, begin, begin });
+                }
+            }
+
+            if (pageNo < 0) {
+                entries.children.push_back(index);
+                entries.folders.back().end++;
+            }
+        }
+        
+        if (ret != SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return ret;
+        }
+
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        SceUInt64 rows = sceKernelGetProcessTimeWide();
+
+        AppList::IndexFolders(entries);
+        entries.stat = stat;
+        SceUInt64 index = sceKernelGetProcessTimeWide();
+
+        AppList::WriteCache(entries);
+        SceUInt64 end = sceKernelGetProcessTimeWide();
+
+        Log::Info("AppList::Get: %u icons, cache check %llu us, open %llu us, rows %llu us, folders %llu us, cache write %llu us\n",
+            entries.Size(), cache - start, open - cache, rows - open, index - rows, end - index);
+        return 0;
+    }
+
+    // Puts every icon and page back where it was loaded and restores the load order, without touching app.db.
+    void Reset(AppEntries &entries) {
+        entries.pageId = entries.origPageId;
+        entries.pageNo = entries.origPageNo;
+        entries.pos = entries.origPos;
+
+        for (AppInfoPage &page : entries.pages) {
+            page.pageNo = page.origPageNo;
+        }
+
+        AppList::Order(entries, SortDefault);
+    }
+
+    // Only reads app.db again if its size or modification time changed since it was loaded.
+    int Refresh(AppEntries &entries) {
+        SceIoStat stat;
+
+        if ((entries.stat.st_size == 0) || R_FAILED(sceIoGetstat(db_path, &stat)) || (stat.st_size != entries.stat.st_size) ||
+            (sceClibMemcmp(&stat.st_mtime, &entries.stat.st_mtime, sizeof(SceDateTime)) != 0)) {
+            return AppList::Get(entries);
+        }
+
+        AppList::Reset(entries);
+        return 0;
+    }
+
+    static void Error(const std::string &query, char *error, sqlite3 *db, const std::string &path) {
+        Log::Error("%s error %s\n", query.c_str(), error);
+        sqlite3_free(error);
+        sqlite3_close(db);
+
+        // Nothing is written to disk while an apply runs on a working copy, so there is nothing to remove.
+        if (!path.empty()) {
+            FS::RemoveFile(path);
+        }
+
+        Power::Unlock();
+    }
+
+    // Prepares a statement once and re-binds it for every row of an operation, instead of building and
+    // parsing a new query string per row.
+    class BulkWriter {
+        public:
+            BulkWriter(sqlite3 *db, const char *query) : db(db), query(query) {
+                ret = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
+            }
+
+            ~BulkWriter() {
+                sqlite3_finalize(stmt);
+            }
+
+            int Prepared(void) const {
+                return ret;
+            }
+
+            sqlite3_stmt *Get(void) const {
+                return stmt;
+            }
+
+            const char *Query(void) const {
+                return query;
+            }
+
+            int Step(void) {
+                ret = sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                return (ret == SQLITE_DONE? SQLITE_OK : ret);
+            }
+
+            // Copies the last error out so it can still be logged once the statement has been finalized.
+            char *Error(void) const {
+                return sqlite3_mprintf("%s", sqlite3_errmsg(db));
+            }
+
+        private:
+            sqlite3 *db = nullptr;
+            sqlite3_stmt *stmt = nullptr;
+            const char *query = nullptr;
+            int ret = 0;
+    };
+
+    void Plan(const AppEntries &entries, AppChanges &changes) {
+        changes.icons.clear();
+        changes.pages.clear();
+
+        for (uint32_t i = 0; i < entries.Size(); i++) {
+            if ((entries.pageId[i] != entries.origPageId[i]) || (entries.pos[i] != entries.origPos[i])) {
+                changes.icons.push_back({ entries.rowid[i], entries.pageId[i], entries.pos[i] });
+            }
+        }
+
+        for (const AppInfoPage &page : entries.pages) {
+            if (page.pageNo != page.origPageNo) {
+                changes.pages.push_back(page);
+            }
+        }
+    }
+
+    static bool Cancelled(const AppProgress *progress) {
+        return progress && progress->cancel.load();
+    }
+
+    static void AddRows(AppProgress *progress, uint32_t rows) {
+        if (progress) {
+            progress->rows += rows;
+        }
+    }
+
+    // The first backup ever taken is kept as app.db.bkp, later ones replace app.db. Backups made before the store
+    // are plain copies of app.db under the same names.
+    static std::string BackupPath(void) {
+        if (!FS::FileExists("ux0:data/VITAHomebrewSorter/backup/app.db.bkp.manifest") && !FS::FileExists("ux0:data/VITAHomebrewSorter/backup/app.db.bkp")) {
+            return "ux0:data/VITAHomebrewSorter/backup/app.db.bkp.manifest";
+        }
+
+        return "ux0:data/VITAHomebrewSorter/backup/app.db.manifest";
+    }
+
+    // Copies the database open on db into memory with the online backup API, so the copy is a consistent snapshot
+    // of the database rather than of the file. Pages are copied a bounded number at a time, reporting how far it got
+    // and stopping between steps once the apply is cancelled.
+    static int Snapshot(sqlite3 *db, std::vector<unsigned char> &data, AppProgress *progress) {
+        const int pages_per_step = 256;
+        const SceUInt64 start = sceKernelGetProcessTimeWide();
+        sqlite3 *dest = nullptr;
+        sqlite3_stmt *stmt = nullptr;
+        int64_t page_size = 0;
+        int ret = 0;
+
+        if (sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, nullptr) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                page_size = sqlite3_column_int64(stmt, 0);
+            }
+        }
+
+        sqlite3_finalize(stmt);
+
+        ret = sqlite3_open_v2(":memory:", &dest, SQLITE_OPEN_READWRITE, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open :memory:\n");
+            sqlite3_close(dest);
+            return ret;
+        }
+
+        // An in-memory destination cannot change its page size once the copy starts, so it has to match up front.
+        const std::string pragma = "PRAGMA page_size = " + std::to_string(page_size);
+        sqlite3_exec(dest, pragma.c_str(), nullptr, nullptr, nullptr);
+
+        sqlite3_backup *backup = sqlite3_backup_init(dest, "main", db, "main");
+        if (!backup) {
+            ret = sqlite3_errcode(dest);
+            Log::Error("sqlite3_backup_init failed: %s\n", sqlite3_errmsg(dest));
+            sqlite3_close(dest);
+            return ret;
+        }
+
+        do {
+            ret = sqlite3_backup_step(backup, pages_per_step);
+
+            if (progress) {
+                const int total = sqlite3_backup_pagecount(backup);
+                progress->totalBytes = total * page_size;
+                progress->bytes = (total - sqlite3_backup_remaining(backup)) * page_size;
+            }
+
+            if ((ret != SQLITE_DONE) && AppList::Cancelled(progress)) {
+                ret = SQLITE_INTERRUPT;
+                break;
+            }
+
+            if ((ret == SQLITE_BUSY) || (ret == SQLITE_LOCKED)) {
+                sceKernelDelayThread(10000);
+            }
+        } while ((ret == SQLITE_OK) || (ret == SQLITE_BUSY) || (ret == SQLITE_LOCKED));
+
+        const int pages = sqlite3_backup_pagecount(backup);
+        const int finish = sqlite3_backup_finish(backup);
+
+        if (ret == SQLITE_DONE) {
+            ret = finish;
+        }
+
+        if (ret != SQLITE_OK) {
+            if (ret != SQLITE_INTERRUPT) {
+                Log::Error("sqlite3_backup_step failed: %s\n", sqlite3_errstr(ret));
+            }
+
+            sqlite3_close(dest);
+            return ret;
+        }
+
+        sqlite3_int64 size = 0;
+        unsigned char *bytes = sqlite3_serialize(dest, "main", &size, 0);
+        if (!bytes) {
+            Log::Error("sqlite3_serialize failed\n");
+            sqlite3_close(dest);
+            return SQLITE_NOMEM;
+        }
+
+        data.assign(bytes, bytes + size);
+        sqlite3_free(bytes);
+        sqlite3_close(dest);
+
+        Log::Info("Snapshot: %d pages of %lld bytes in %llu us\n", pages, page_size, sceKernelGetProcessTimeWide() - start);
+        return 0;
+    }
+
+    // Snapshots the database open on db into data and keeps it as the backup manifest. Only the pages that changed
+    // since the previous backup or any loadout are written.
+    static int Backup(sqlite3 *db, std::vector<unsigned char> &data, AppProgress *progress) {
+        int ret = 0;
+
+        if ((ret = AppList::Snapshot(db, data, progress)) != SQLITE_OK) {
+            return ret;
+        }
+
+        return Store::Write(AppList::BackupPath(), { { db_path, data.data(), static_cast<SceOff>(data.size()) } });
+    }
+
+    // Replaces the connection on db with an in-memory working copy of data (the backup snapshot), so an apply runs
+    // without any journal or page writes on ur0:. Returns false and keeps db when there is not enough memory.
+    static bool WorkingCopy(sqlite3 **db, const std::vector<unsigned char> &data) {
+        sqlite3 *copy = nullptr;
+        const sqlite3_int64 size = static_cast<sqlite3_int64>(data.size());
+
+        unsigned char *bytes = static_cast<unsigned char *>(sqlite3_malloc64(size));
+        if (!bytes) {
+            Log::Error("WorkingCopy: could not allocate %lld bytes, applying directly to %s\n", size, db_path);
+            return false;
+        }
+
+        std::memcpy(bytes, data.data(), data.size());
+
+        if (sqlite3_open_v2(":memory:", &copy, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open :memory:\n");
+            sqlite3_free(bytes);
+            sqlite3_close(copy);
+            return false;
+        }
+
+        // bytes is freed by SQLite from here on, including when this fails.
+        int ret = sqlite3_deserialize(copy, "main", bytes, size, size, SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_deserialize failed: %s\n", sqlite3_errstr(ret));
+            sqlite3_close(copy);
+            return false;
+        }
+
+        sqlite3_close(*db);
+        *db = copy;
+        return true;
+    }
+
+    // Reads the file change counter, bytes 24-27 of the database header, of app.db. Every commit the shell makes in
+    // rollback journal mode increments it.
+    static bool ChangeCounter(uint32_t &counter) {
+        unsigned char header[28] = { 0 };
+
+        if (FS::ReadFile(db_path, header, sizeof(header)) != static_cast<int>(sizeof(header))) {
+            Log::Error("ChangeCounter: could not read the header of %s\n", db_path);
+            return false;
+        }
+
+        counter = (header[24] << 24) | (header[25] << 16) | (header[26] << 8) | header[27];
+        return true;
+    }
+
+    // Checks the working copy on db and writes it over app.db in one pass: to app.db.tmp, synced, then swapped in by
+    // FS::ReplaceFile. If the swap is interrupted app.db may be missing with the old database left as app.db.old, which
+    // Services::Init restores on the next launch (the shell rebuilds app.db if it boots first).
+    //
+    // The psp2 VFS has no locks the shell would see, so app.db is not locked while the apply runs on the working copy.
+    // counter is app.db's change counter from before the snapshot, and anything the shell committed since then would
+    // be lost by the swap, so app.db is left alone if the counter moved. The shell only writes app.db when the
+    // LiveArea changes, which while this app is in the foreground is limited to something like a background download
+    // finishing, so the window between the check and the swap is small. The shell keeps using what it already loaded
+    // until the reboot the app asks for after an apply, and reads the swapped in app.db from then on.
+    static int WriteBack(sqlite3 *db, uint32_t counter) {
+        const SceUInt64 start = sceKernelGetProcessTimeWide();
+        const std::string temp_path = std::string(db_path) + ".tmp";
+        sqlite3_stmt *stmt = nullptr;
+        int ret = 0;
+
+        ret = sqlite3_prepare_v2(db, "PRAGMA quick_check", -1, &stmt, nullptr);
+        if (ret == SQLITE_OK) {
+            ret = sqlite3_step(stmt);
+
+            if ((ret == SQLITE_ROW) && (std::strcmp(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)), "ok") == 0)) {
+                ret = SQLITE_OK;
+            }
+            else {
+                Log::Error("WriteBack: quick_check failed: %s\n", (ret == SQLITE_ROW)? reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)) : sqlite3_errmsg(db));
+                ret = SQLITE_CORRUPT;
+            }
+        }
+
+        sqlite3_finalize(stmt);
+
+        if (ret != SQLITE_OK) {
+            return ret;
+        }
+
+        // The working copy is already one contiguous image, so it is written from SQLite's own buffer.
+        sqlite3_int64 size = 0;
+        unsigned char *bytes = sqlite3_serialize(db, "main", &size, SQLITE_SERIALIZE_NOCOPY);
+        if (!bytes) {
+            Log::Error("sqlite3_serialize failed\n");
+            return SQLITE_NOMEM;
+        }
+
+        SceUID file = 0;
+        if (R_FAILED(ret = file = sceIoOpen(temp_path.c_str(), SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777))) {
+            Log::Error("sceIoOpen(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            return ret;
+        }
+
+        if ((ret = sceIoWrite(file, bytes, size)) != size) {
+            Log::Error("sceIoWrite(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            sceIoClose(file);
+            FS::RemoveFile(temp_path);
+            return R_FAILED(ret)? ret : SQLITE_IOERR_WRITE;
+        }
+
+        if (R_FAILED(ret = sceIoSyncByFd(file, 0))) {
+            Log::Error("sceIoSyncByFd(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            sceIoClose(file);
+            FS::RemoveFile(temp_path);
+            return ret;
+        }
+
+        if (R_FAILED(ret = sceIoClose(file))) {
+            Log::Error("sceIoClose(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            FS::RemoveFile(temp_path);
+            return ret;
+        }
+
+        uint32_t current = 0;
+        if (!AppList::ChangeCounter(current) || (current != counter)) {
+            Log::Error("WriteBack: %s changed since it was read (counter %u, now %u), not replacing it\n", db_path, counter, current);
+            FS::RemoveFile(temp_path);
+            return SQLITE_BUSY;
+        }
+
+        if (R_FAILED(ret = FS::ReplaceFile(temp_path, db_path))) {
+            return ret;
+        }
+
+        Log::Info("WriteBack: %lld bytes in %llu us\n", size, sceKernelGetProcessTimeWide() - start);
+        return 0;
+    }
+
+    // Progress handler that interrupts the running statement once the apply is cancelled.
+    static int Interrupt(void *progress) {
+        return AppList::Cancelled(static_cast<AppProgress *>(progress))? 1 : 0;
+    }
+
+    // Closing the database before COMMIT rolls the transaction back, so a cancelled apply leaves app.db as it was.
+    static int Cancel(sqlite3 *db, char *error) {
+        Log::Info("Apply cancelled before commit\n");
+        sqlite3_free(error);
+        sqlite3_close(db);
+        Power::Unlock();
+        return SQLITE_INTERRUPT;
+    }
+
+    // Bulk loads the target (rowid, pageId, pos) of every moved icon into temp.tbl_appinfo_icon_target.
+    static int LoadIconTargets(sqlite3 *db, const std::vector<AppIconChange> &entries, std::string &query, char **error, AppProgress *progress) {
+        int ret = 0;
+        BulkWriter writer(db, "INSERT INTO temp.tbl_appinfo_icon_target VALUES (?1, ?2, ?3)");
+
+        if ((ret = writer.Prepared()) != SQLITE_OK) {
+            query = writer.Query();
+            *error = writer.Error();
+            return ret;
+        }
+
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            if (AppList::Cancelled(progress)) {
+                return SQLITE_INTERRUPT;
+            }
+
+            sqlite3_bind_int64(writer.Get(), 1, entries[i].rowid);
+            sqlite3_bind_int(writer.Get(), 2, entries[i].pageId);
+            sqlite3_bind_int(writer.Get(), 3, entries[i].pos);
+
+            if ((ret = writer.Step()) != SQLITE_OK) {
+                query = writer.Query();
+                *error = writer.Error();
+                return ret;
+            }
+
+            AppList::AddRows(progress, 1);
+        }
+
+        return 0;
+    }
+
+    // Bulk loads the target (pageId, pageNo) of every moved page into temp.tbl_appinfo_page_target.
+    static int LoadPageTargets(sqlite3 *db, const std::vector<AppInfoPage> &entries, std::string &query, char **error, AppProgress *progress) {
+        int ret = 0;
+        BulkWriter writer(db, "INSERT INTO temp.tbl_appinfo_page_target VALUES (?1, ?2)");
+
+        if ((ret = writer.Prepared()) != SQLITE_OK) {
+            query = writer.Query();
+            *error = writer.Error();
+            return ret;
+        }
+
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            if (AppList::Cancelled(progress)) {
+                return SQLITE_INTERRUPT;
+            }
+
+            sqlite3_bind_int(writer.Get(), 1, entries[i].pageId);
+            sqlite3_bind_int(writer.Get(), 2, entries[i].pageNo);
+
+            if ((ret = writer.Step()) != SQLITE_OK) {
+                query = writer.Query();
+                *error = writer.Error();
+                return ret;
+            }
+
+            AppList::AddRows(progress, 1);
+        }
+
+        return 0;
+    }
+
+    int Save(const std::vector<AppIconChange> &changes, AppProgress *progress) {
+        int ret = 0;
+        sqlite3 *db = nullptr;
+        char *error = nullptr;
+
+        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            FS::RemoveFile(db_path);
+            return ret;
+        }
+
+        // Lock power and prevent auto suspend.
+        Power::Lock();
+
+        // Read before the snapshot, so WriteBack can tell whether the shell wrote app.db at any point after it.
+        uint32_t counter = 0;
+        if (!AppList::ChangeCounter(counter)) {
+            sqlite3_close(db);
+            Power::Unlock();
+            return SQLITE_IOERR_READ;
+        }
+
+        // The only copy taken per apply, read through this connection before anything is written. It also becomes
+        // the working copy the apply runs on, app.db is then only written once it is done.
+        std::vector<unsigned char> data;
+        if ((ret = AppList::Backup(db, data, progress)) != SQLITE_OK) {
+            sqlite3_close(db);
+            Power::Unlock();
+            return ret;
+        }
+
+        const bool working_copy = AppList::WorkingCopy(&db, data);
+        const std::string path = working_copy? "" : db_path;
+        data.clear();
+        data.shrink_to_fit();
+
+        // Every target row is counted once when loaded and once per UPDATE that writes it.
+        if (progress) {
+            progress->rows = 0;
+            progress->totalRows = 3 * changes.size();
+            sqlite3_progress_handler(db, 1000, AppList::Interrupt, progress);
+        }
+
+        // The psp2 VFS cannot open anonymous temp files, so the target table has to stay in memory.
+        const char *prepare_query[] = {
+            "PRAGMA temp_store = MEMORY",
+            "PRAGMA foreign_keys = off",
+            "BEGIN TRANSACTION",
+            "CREATE TEMP TABLE tbl_appinfo_icon_target(iconRowid INTEGER PRIMARY KEY, pageId INT NOT NULL, pos INT NOT NULL)"
+        };
+        
+        for (int i = 0; i < 4; ++i) {
+            if (AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            ret = sqlite3_exec(db, prepare_query[i], nullptr, nullptr, &error);
+            if (ret != SQLITE_OK) {
+                if (AppList::Cancelled(progress)) {
+                    return AppList::Cancel(db, error);
+                }
+
+                AppList::Error(prepare_query[i], error, db, path);
+                return ret;
+            }
+        }
+
+        // If this fails, closing the database rolls back the transaction along with the temp table.
+        std::string query;
+        if ((ret = AppList::LoadIconTargets(db, changes, query, &error, progress)) != SQLITE_OK) {
+            if (AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            AppList::Error(query, error, db, path);
+            return ret;
+        }
+
+        // Icons that move are first parked on a unique negative pos, so that no intermediate state collides on
+        // PRIMARY KEY(pageId, pos), then moved to their targets. Icons already in place are never written.
+        const char *finish_query[] = {
+            "UPDATE tbl_appinfo_icon SET pos = -1 - tbl_appinfo_icon.rowid FROM temp.tbl_appinfo_icon_target AS target "
+                "WHERE tbl_appinfo_icon.rowid = target.iconRowid AND (tbl_appinfo_icon.pageId != target.pageId OR tbl_appinfo_icon.pos != target.pos)",
+            "UPDATE tbl_appinfo_icon SET pageId = target.pageId, pos = target.pos FROM temp.tbl_appinfo_icon_target AS target "
+                "WHERE tbl_appinfo_icon.rowid = target.iconRowid AND (tbl_appinfo_icon.pageId != target.pageId OR tbl_appinfo_icon.pos != target.pos)",
+            "DROP TABLE temp.tbl_appinfo_icon_target",
+            "COMMIT",
+            "PRAGMA foreign_keys = on"
+        };
+
+        for (int i = 0; i < 5; ++i) {
+            // Once COMMIT starts the apply can no longer be cancelled.
+            if (i == 3) {
+                sqlite3_progress_handler(db, 0, nullptr, nullptr);
+            }
+            else if ((i < 3) && AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            ret = sqlite3_exec(db, finish_query[i], nullptr, nullptr, &error);
+            if (ret != SQLITE_OK) {
+                if ((i < 3) && AppList::Cancelled(progress)) {
+                    return AppList::Cancel(db, error);
+                }
+
+                AppList::Error(finish_query[i], error, db, path);
+                return ret;
+            }
+
+            // Only the UPDATEs write rows, sqlite3_changes keeps their count through the statements after them.
+            if (i < 2) {
+                AppList::AddRows(progress, sqlite3_changes(db));
+            }
+        }
+
+        if (working_copy && ((ret = AppList::WriteBack(db, counter)) != 0)) {
+            sqlite3_close(db);
+            Power::Unlock();
+            return ret;
+        }
+
+        Power::Unlock();
+        sqlite3_close(db);
+        return 0;
+    }
+
+    int SavePages(const std::vector<AppInfoPage> &changes, AppProgress *progress) {
+        int ret = 0;
+        sqlite3 *db = nullptr;
+        char *error = nullptr;
+
+        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            FS::RemoveFile(db_path);
+            return ret;
+        }
+
+        // Lock power and prevent auto suspend.
+        Power::Lock();
+
+        // The only copy taken per apply, read through this connection before anything is written. Swapping pages
+        // only rewrites a few rows of tbl_appinfo_page, so unlike Save this writes to app.db directly rather than
+        // rewriting all of it from a working copy.
+        std::vector<unsigned char> data;
+        if ((ret = AppList::Backup(db, data, progress)) != SQLITE_OK) {
+            sqlite3_close(db);
+            Power::Unlock();
+            return ret;
+        }
+
+        // Every target row is counted once when loaded and once per UPDATE that writes it.
+        if (progress) {
+            progress->rows = 0;
+            progress->totalRows = 2 * changes.size();
+            sqlite3_progress_handler(db, 1000, AppList::Interrupt, progress);
+        }
+
+        const char *prepare_query[] = {
+            "PRAGMA temp_store = MEMORY",
+            "PRAGMA foreign_keys = off",
+            "BEGIN TRANSACTION",
+            "CREATE TEMP TABLE tbl_appinfo_page_target(pageId INTEGER PRIMARY KEY, pageNo INT NOT NULL)"
+        };
+        
+        for (int i = 0; i < 4; ++i) {
+            if (AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            ret = sqlite3_exec(db, prepare_query[i], nullptr, nullptr, &error);
+            if (ret != SQLITE_OK) {
+                if (AppList::Cancelled(progress)) {
+                    return AppList::Cancel(db, error);
+                }
+
+                AppList::Error(prepare_query[i], error, db, db_path);
+                return ret;
+            }
+        }
+
+        // If this fails, closing the database rolls back the transaction along with the temp table.
+        std::string query;
+        if ((ret = AppList::LoadPageTargets(db, changes, query, &error, progress)) != SQLITE_OK) {
+            if (AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            AppList::Error(query, error, db, db_path);
+            return ret;
+        }
+
+        // pageNo is not unique and tgr_deletePage2/tgr_insertPage2 only fire on DELETE/INSERT, so the swapped pages
+        // can be updated in place with a single statement.
+        const char *finish_query[] = {
+            "UPDATE tbl_appinfo_page SET pageNo = target.pageNo FROM temp.tbl_appinfo_page_target AS target "
+                "WHERE tbl_appinfo_page.pageId = target.pageId AND tbl_appinfo_page.pageNo != target.pageNo",
+            "DROP TABLE temp.tbl_appinfo_page_target",
+            "COMMIT",
+            "PRAGMA foreign_keys = on"
+        };
+
+        for (int i = 0; i < 4; ++i) {
+            // Once COMMIT starts the apply can no longer be cancelled.
+            if (i == 2) {
+                sqlite3_progress_handler(db, 0, nullptr, nullptr);
+            }
+            else if ((i < 2) && AppList::Cancelled(progress)) {
+                return AppList::Cancel(db, error);
+            }
+
+            ret = sqlite3_exec(db, finish_query[i], nullptr, nullptr, &error);
+            if (ret != SQLITE_OK) {
+                if ((i < 2) && AppList::Cancelled(progress)) {
+                    return AppList::Cancel(db, error);
+                }
+
+                AppList::Error(finish_query[i], error, db, db_path);
+                return ret;
+            }
+
+            if (i == 0) {
+                AppList::AddRows(progress, sqlite3_changes(db));
+            }
+        }
+
+        Power::Unlock();
+        sqlite3_close(db);
+        return 0;
+    }
+
+    // Half-width katakana U+FF66 to U+FF9D as their full-width forms.
+    static const uint16_t half_width_kana[] = {
+        0x30F2, 0x30A1, 0x30A3, 0x30A5, 0x30A7, 0x30A9, 0x30E3, 0x30E5, 0x30E7, 0x30C3,
+        0x30FC, 0x30A2, 0x30A4, 0x30A6, 0x30A8, 0x30AA, 0x30AB, 0x30AD, 0x30AF, 0x30B1, 0x30B3, 0x30B5, 0x30B7, 0x30B9, 0x30BB, 0x30BD,
+        0x30BF, 0x30C1, 0x30C4, 0x30C6, 0x30C8, 0x30CA, 0x30CB, 0x30CC, 0x30CD, 0x30CE, 0x30CF, 0x30D2, 0x30D5, 0x30D8, 0x30DB, 0x30DE,
+        0x30DF, 0x30E0, 0x30E1, 0x30E2, 0x30E4, 0x30E6, 0x30E8, 0x30E9, 0x30EA, 0x30EB, 0x30EC, 0x30ED, 0x30EF, 0x30F3
+    };
+
+    static uint32_t Decode(const unsigned char *&str) {
+        uint32_t c = *str++;
+        int length = (c >= 0xF0 && c < 0xF5)? 3 : (c >= 0xE0)? 2 : (c >= 0xC2)? 1 : 0;
+        if (c >= 0xF5 || length == 0) {
+            return c; // ASCII, or a stray byte which is kept as is.
+        }
+
+        uint32_t cp = c & (0x3F >> length);
+        for (int i = 0; i < length; i++) {
+            if ((str[i] & 0xC0) != 0x80) {
+                return c;
+            }
+
+            cp = (cp << 6) | (str[i] & 0x3F);
+        }
+
+        str += length;
+        return cp;
+    }
+
+    static void Encode(uint32_t cp, std::vector<uint8_t> &out) {
+        if (cp < 0x80) {
+            out.push_back(cp);
+        }
+        else if (cp < 0x800) {
+            out.push_back(0xC0 | (cp >> 6));
+            out.push_back(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000) {
+            out.push_back(0xE0 | (cp >> 12));
+            out.push_back(0x80 | ((cp >> 6) & 0x3F));
+            out.push_back(0x80 | (cp & 0x3F));
+        }
+        else {
+            out.push_back(0xF0 | (cp >> 18));
+            out.push_back(0x80 | ((cp >> 12) & 0x3F));
+            out.push_back(0x80 | ((cp >> 6) & 0x3F));
+            out.push_back(0x80 | (cp & 0x3F));
+        }
+    }
+
+    static uint32_t Fold(uint32_t cp) {
+        if (cp >= 0xFF01 && cp <= 0xFF5E) { // Full-width ASCII
+            cp -= 0xFEE0;
+        }
+        else if (cp == 0x3000) { // Ideographic space
+            cp = ' ';
+        }
+        else if (cp >= 0xFF66 && cp <= 0xFF9D) {
+            cp = half_width_kana[cp - 0xFF66];
+        }
+
+        if (cp < 0x80) {
+            return (cp >= 'A' && cp <= 'Z')? cp + 0x20 : cp;
+        }
+        else if (cp >= 0x30A1 && cp <= 0x30F6) { // Katakana sorts with hiragana
+            return cp - 0x60;
+        }
+        else if ((cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) || (cp >= 0x391 && cp <= 0x3A9) || (cp >= 0x410 && cp <= 0x42F)) {
+            return cp + 0x20;
+        }
+        else if (cp >= 0x400 && cp <= 0x40F) {
+            return cp + 0x50;
+        }
+        else if ((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177)) {
+            return cp | 1;
+        }
+        else if (cp >= 0x139 && cp <= 0x148) {
+            return cp + (cp & 1);
+        }
+
+        return cp;
+    }
+
+    // Hiragana with a voiced form, after a half-width (semi-)voiced sound mark.
+    static uint32_t Voice(uint32_t cp, uint32_t mark) {
+        if (mark == 0xFF9E) {
+            if ((cp >= 0x304B && cp <= 0x3061 && (cp & 1)) || cp == 0x3064 || cp == 0x3066 || cp == 0x3068) {
+                return cp + 1;
+            }
+            else if (cp == 0x3046) {
+                return 0x3094;
+            }
+        }
+
+        if (cp >= 0x306F && cp <= 0x307B && (cp - 0x306F) % 3 == 0) {
+            return cp + ((mark == 0xFF9E)? 1 : 2);
+        }
+
+        return 0;
+    }
+
+    // Appends a key that orders titles by code point after case folding, mapping full-width ASCII to
+    // half-width and katakana to hiragana. UTF-8 keeps code point order, so keys compare with plain bytes.
+    static void CollationKey(const char *title, std::vector<uint8_t> &out) {
+        const unsigned char *str = reinterpret_cast<const unsigned char *>(title);
+        uint32_t prev = 0;
+        std::size_t prevAt = out.size();
+
+        while (*str != '\0') {
+            uint32_t cp = Decode(str);
+
+            if (cp == 0xFF9E || cp == 0xFF9F) {
+                uint32_t voiced = AppList::Voice(prev, cp);
+                if (voiced != 0) {
+                    out.resize(prevAt);
+                    AppList::Encode(voiced, out);
+                    prev = 0;
+                    continue;
+                }
+            }
+
+            cp = AppList::Fold(cp);
+            prev = cp;
+            prevAt = out.size();
+            AppList::Encode(cp, out);
+        }
+
+        out.push_back('\0');
+    }
+
+    static void BuildTitleKeys(const AppEntries &entries, AppSortKeys &keys) {
+        const uint32_t size = entries.Size();
+
+        keys.prefix.resize(size);
+        keys.offset.resize(size);
+        keys.bytes.clear();
+
+        for (uint32_t i = 0; i < size; i++) {
+            keys.offset[i] = keys.bytes.size();
+            AppList::CollationKey(entries.Title(i), keys.bytes);
+
+            const uint8_t *key = &keys.bytes[keys.offset[i]];
+            uint32_t prefix = 0;
+            for (int j = 0; j < 4; j++) {
+                prefix = (prefix << 8) | *key;
+                key += (*key != '\0');
+            }
+
+            keys.prefix[i] = prefix;
+        }
+
+        std::sort(keys.sorted.begin(), keys.sorted.end(), [&keys](uint32_t indexA, uint32_t indexB) {
+            if (keys.prefix[indexA] != keys.prefix[indexB]) {
+                return keys.prefix[indexA] < keys.prefix[indexB];
+            }
+
+            int ret = std::strcmp(reinterpret_cast<const char *>(&keys.bytes[keys.offset[indexA]]), reinterpret_cast<const char *>(&keys.bytes[keys.offset[indexB]]));
+            return (ret != 0)? (ret < 0) : (indexA < indexB);
+        });
+    }
+
+    static void BuildTitleIdKeys(const AppEntries &entries, AppSortKeys &keys) {
+        // Malformed IDs all pack to InvalidTitleId, so they sort after every valid one and among themselves by string.
+        std::sort(keys.sorted.begin(), keys.sorted.end(), [&entries](uint32_t indexA, uint32_t indexB) {
+            uint64_t keyA = entries.titleIdKey[indexA];
+            uint64_t keyB = entries.titleIdKey[indexB];
+            if (keyA != keyB) {
+                return keyA < keyB;
+            }
+
+            int ret = (keyA == InvalidTitleId)? std::strcmp(entries.TitleId(indexA), entries.TitleId(indexB)) : 0;
+            return (ret != 0)? (ret < 0) : (indexA < indexB);
+        });
+    }
+
+    static void BuildKeys(AppEntries &entries, int sortBy) {
+        AppSortKeys &keys = entries.keys[sortBy];
+        const uint32_t size = entries.Size();
+
+        keys.sorted.resize(size);
+        for (uint32_t i = 0; i < size; i++) {
+            keys.sorted[i] = i;
+        }
+
+        if (sortBy == SortTitle) {
+            AppList::BuildTitleKeys(entries, keys);
+        }
+        else {
+            AppList::BuildTitleIdKeys(entries, keys);
+        }
+
+        keys.rank.resize(size);
+        for (uint32_t i = 0; i < size; i++) {
+            keys.rank[keys.sorted[i]] = i;
+        }
+
+        keys.built = true;
+    }
+
+    void Order(AppEntries &entries, int mode) {
+        if (mode == SortDefault) {
+            for (uint32_t i = 0; i < entries.Size(); i++) {
+                entries.order[i] = i;
+            }
+
+            for (const AppInfoFolder &folder : entries.folders) {
+                std::sort(entries.children.begin() + folder.begin, entries.children.begin() + folder.end);
+            }
+
+            return;
+        }
+
+        // Each key's permutation is built the first time it is used and kept until the next load.
+        const AppSortKeys &keys = entries.keys[cfg.sort_by];
+        if (!keys.built) {
+            AppList::BuildKeys(entries, cfg.sort_by);
+        }
+
+        // Asc and Desc only differ in which direction the ascending permutation is read.
+        const std::vector<uint32_t> &sorted = keys.sorted;
+        if (mode == SortAsc) {
+            std::copy(sorted.begin(), sorted.end(), entries.order.begin());
+        }
+        else {
+            std::copy(sorted.rbegin(), sorted.rend(), entries.order.begin());
+        }
+
+        const std::vector<uint32_t> &rank = keys.rank;
+        for (const AppInfoFolder &folder : entries.folders) {
+            std::sort(entries.children.begin() + folder.begin, entries.children.begin() + folder.end, [&rank, mode](uint32_t indexA, uint32_t indexB) {
+                return (mode == SortAsc)? (rank[indexA] < rank[indexB]) : (rank[indexA] > rank[indexB]);
+            });
+        }
+    }
+    
+    // The catalog cache holds everything Get loads plus both sort permutations, so a launch with an unchanged app.db
+    // is a single sequential read. It is only used while app.db has the size and mtime recorded in the header.
+    constexpr char cache_path[] = "ux0:data/VITAHomebrewSorter/app.cache";
+    constexpr uint32_t CACHE_MAGIC = 0x43534856; // "VHSC"
+    constexpr uint32_t CACHE_VERSION = 1;
+
+    struct CacheHeader {
+        uint32_t magic = CACHE_MAGIC;
+        uint32_t version = CACHE_VERSION;
+        SceOff dbSize = 0;
+        SceDateTime dbMtime;
+        uint32_t size = 0;     // Bytes after the header.
+        uint32_t checksum = 0; // FNV-1a of the bytes after the header.
+    };
+
+    static uint32_t Checksum(const char *data, uint32_t size) {
+        uint32_t hash = 2166136261u;
+        for (uint32_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    template<typename T>
+    static void Put(std::vector<char> &data, const std::vector<T> &values) {
+        const uint32_t count = values.size();
+        const char *bytes = reinterpret_cast<const char *>(values.data());
+        data.insert(data.end(), reinterpret_cast<const char *>(&count), reinterpret_cast<const char *>(&count) + sizeof(count));
+        data.insert(data.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    template<typename T>
+    static bool Take(const char *&cursor, const char *end, std::vector<T> &values) {
+        uint32_t count = 0;
+        if (static_cast<uint32_t>(end - cursor) < sizeof(count)) {
+            return false;
+        }
+
+        sceClibMemcpy(&count, cursor, sizeof(count));
+        cursor += sizeof(count);
+
+        if ((end - cursor) / sizeof(T) < count) {
+            return false;
+        }
+
+        values.resize(count);
+        sceClibMemcpy(values.data(), cursor, count * sizeof(T));
+        cursor += count * sizeof(T);
+        return true;
+    }
+
+    static bool ReadCache(AppEntries &entries, const SceIoStat &stat) {
+        SceOff size = 0;
+        CacheHeader header;
+
+        if ((stat.st_size == 0) || !FS::FileExists(cache_path) || R_FAILED(FS::GetFileSize(cache_path, size)) ||
+            (size < static_cast<SceOff>(sizeof(CacheHeader)))) {
+            return false;
+        }
+
+        std::vector<char> data(size);
+        if (FS::ReadFile(cache_path, data.data(), size) != size) {
+            return false;
+        }
+
+        sceClibMemcpy(&header, data.data(), sizeof(CacheHeader));
+        const char *cursor = data.data() + sizeof(CacheHeader);
+        const char *end = data.data() + data.size();
+
+        if ((header.magic != CACHE_MAGIC) || (header.version != CACHE_VERSION) || (header.dbSize != stat.st_size) ||
+            (sceClibMemcmp(&header.dbMtime, &stat.st_mtime, sizeof(SceDateTime)) != 0) || (header.size != static_cast<uint32_t>(end - cursor)) ||
+            (header.checksum != AppList::Checksum(cursor, header.size))) {
+            return false;
+        }
+
+        std::vector<char> strings;
+        bool ok = AppList::Take(cursor, end, entries.pageId) && AppList::Take(cursor, end, entries.pageNo) && AppList::Take(cursor, end, entries.pos) &&
+            AppList::Take(cursor, end, entries.icon0Type) && AppList::Take(cursor, end, entries.rowid) && AppList::Take(cursor, end, entries.title) &&
+            AppList::Take(cursor, end, entries.titleId) && AppList::Take(cursor, end, entries.reserved01) && AppList::Take(cursor, end, entries.titleIdKey) &&
+            AppList::Take(cursor, end, strings) && AppList::Take(cursor, end, entries.children) && AppList::Take(cursor, end, entries.folder) &&
+            AppList::Take(cursor, end, entries.pages) && AppList::Take(cursor, end, entries.folders);
+
+        for (AppSortKeys &keys : entries.keys) {
+            ok = ok && AppList::Take(cursor, end, keys.prefix) && AppList::Take(cursor, end, keys.offset) && AppList::Take(cursor, end, keys.bytes) &&
+                AppList::Take(cursor, end, keys.sorted) && AppList::Take(cursor, end, keys.rank);
+            keys.built = ok;
+        }
+
+        const uint32_t count = entries.pageId.size();
+        ok = ok && (cursor == end) && (entries.pageNo.size() == count) && (entries.pos.size() == count) && (entries.icon0Type.size() == count) &&
+            (entries.rowid.size() == count) && (entries.title.size() == count) && (entries.titleId.size() == count) &&
+            (entries.reserved01.size() == count) && (entries.titleIdKey.size() == count) && (entries.folder.size() == count) &&
+            (entries.keys[SortTitle].sorted.size() == count) && (entries.keys[SortTitleID].sorted.size() == count);
+
+        if (!ok) {
+            Log::Error("Catalog cache %s is malformed\n", cache_path);
+            AppList::Clear(entries);
+            return false;
+        }
 
-        sqlite3 *db = nullptr;
-        int ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
-        if (ret != SQLITE_OK) {
-            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
-            return ret;
+        entries.strings.Assign(std::move(strings));
+        entries.origPageId = entries.pageId;
+        entries.origPageNo = entries.pageNo;
+        entries.origPos = entries.pos;
+        entries.order.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            entries.order[i] = i;
         }
 
-        std::string query = std::string("SELECT info_icon.pageId, info_page.pageNo, info_icon.pos, info_icon.title, info_icon.titleId, info_icon.reserved01, ")
-            + "info_icon.icon0Type "
-            + "FROM tbl_appinfo_icon info_icon "
-            + "INNER JOIN tbl_appinfo_page info_page "
-            + "ON info_icon.pageId = info_page.pageId;";
-        
-        sqlite3_stmt *stmt = nullptr;
-        ret = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+        return true;
+    }
 
-        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-            AppInfoIcon icon;
-            AppInfoChild child;
-
-            icon.pageId = std::stoi(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-            icon.pageNo = sqlite3_column_int(stmt, 1);
-            icon.pos = sqlite3_column_int(stmt, 2);
-            sceClibSnprintf(icon.title, 128, "%s", sqlite3_column_text(stmt, 3));
-            sceClibSnprintf(icon.titleId, 16, "%s", sqlite3_column_text(stmt, 4));
-            sceClibSnprintf(icon.reserved01, 16, "%s", sqlite3_column_text(stmt, 5));
-            icon.icon0Type = std::stoi(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6))); // 7 = folder
-            
-            if (icon.pageNo < 0) {
-                child.pageId = icon.pageId;
-                child.pageNo = icon.pageNo;
-                child.pos = icon.pos;
-                sceClibSnprintf(child.title, 128, icon.title);
-                sceClibSnprintf(child.titleId, 16, icon.titleId);
+    static void WriteCache(AppEntries &entries) {
+        if (entries.stat.st_size == 0) {
+            return;
+        }
+
+        for (int sortBy : { SortTitle, SortTitleID }) {
+            if (!entries.keys[sortBy].built) {
+                AppList::BuildKeys(entries, sortBy);
             }
+        }
 
-            entries.icons.push_back(icon);
-            entries.child_apps.push_back(child);
+        CacheHeader header;
+        std::vector<char> data(sizeof(CacheHeader));
+        AppList::Put(data, entries.pageId);
+        AppList::Put(data, entries.pageNo);
+        AppList::Put(data, entries.pos);
+        AppList::Put(data, entries.icon0Type);
+        AppList::Put(data, entries.rowid);
+        AppList::Put(data, entries.title);
+        AppList::Put(data, entries.titleId);
+        AppList::Put(data, entries.reserved01);
+        AppList::Put(data, entries.titleIdKey);
+        AppList::Put(data, entries.strings.Data());
+        AppList::Put(data, entries.children);
+        AppList::Put(data, entries.folder);
+        AppList::Put(data, entries.pages);
+        AppList::Put(data, entries.folders);
+
+        for (const AppSortKeys &keys : entries.keys) {
+            AppList::Put(data, keys.prefix);
+            AppList::Put(data, keys.offset);
+            AppList::Put(data, keys.bytes);
+            AppList::Put(data, keys.sorted);
+            AppList::Put(data, keys.rank);
         }
+
+        header.dbSize = entries.stat.st_size;
+        header.dbMtime = entries.stat.st_mtime;
+        header.size = data.size() - sizeof(CacheHeader);
+        header.checksum = AppList::Checksum(data.data() + sizeof(CacheHeader), header.size);
+        sceClibMemcpy(data.data(), &header, sizeof(CacheHeader));
+
+        FS::WriteFile(cache_path, data.data(), data.size());
+    }
+
+    void Sort(AppEntries &entries) {
+        const int MAX_POS = 9;
+        int pos = 0, pageCounter = 0;
         
-        if (ret != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return ret;
+        for (uint32_t i : entries.order) {
+            if ((entries.pageNo[i] < 0) || (cfg.sort_folders == SortFoldersOnly)) {
+                continue;
+            }
+
+            // Reset position
+            if (pos > MAX_POS) {
+                pos = 0;
+                pageCounter++;
+            }
+            
+            entries.pos[i] = pos;
+            entries.pageId[i] = entries.pages[pageCounter].pageId;
+            pos++;
         }
-        
-        sqlite3_finalize(stmt);
 
-        query = std::string("SELECT DISTINCT info_page.pageId, info_page.pageNo ")
-            + "FROM tbl_appinfo_page info_page "
-            + "INNER JOIN tbl_appinfo_icon info_icon "
-            + "ON info_page.pageId = info_icon.pageId "
-            + "ORDER BY info_page.pageId;";
+        // App/Game belongs to a folder. Each folder's range is already in sort order.
+        if (cfg.sort_folders != SortAppsOnly) {
+            for (const AppInfoFolder &folder : entries.folders) {
+                for (uint32_t j = folder.begin; j < folder.end; j++) {
+                    entries.pos[entries.children[j]] = folder.index + (j - folder.begin);
+                }
+            }
+        }
+    }
+
+    // Marks the longest run of slots whose ranks are already increasing. Those icons can stay where they are.
+    static std::vector<bool> KeepSorted(const std::vector<int> &ranks) {
+        std::vector<bool> keep(ranks.size(), false);
+        std::vector<int> tails, prev(ranks.size(), -1);
 
-        ret = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+        for (unsigned int i = 0; i < ranks.size(); i++) {
+            auto it = std::lower_bound(tails.begin(), tails.end(), i, [&ranks](int index, int value) {
+                return ranks[index] < ranks[value];
+            });
 
-        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-            AppInfoPage page;
-            AppInfoFolder folder;
-            
-            int pageNo = sqlite3_column_int(stmt, 1);
+            if (it != tails.begin()) {
+                prev[i] = *(it - 1);
+            }
 
-            if (pageNo >= 0) {
-                page.pageId = sqlite3_column_int(stmt, 0);
-                page.pageNo = pageNo;
-                entries.pages.push_back(page);
+            if (it == tails.end()) {
+                tails.push_back(i);
             }
-            else if (pageNo < 0) {
-                folder.pageId = sqlite3_column_int(stmt, 0);
-                entries.folders.push_back(folder);
+            else {
+                *it = i;
             }
         }
 
-        if (ret != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return ret;
+        for (int i = tails.empty()? -1 : tails.back(); i != -1; i = prev[i]) {
+            keep[i] = true;
         }
 
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return 0;
+        return keep;
     }
 
-    static void Error(const std::string &query, char *error, sqlite3 *db, const std::string &path) {
-        Log::Error("%s error %s\n", query.c_str(), error);
-        sqlite3_free(error);
-        sqlite3_close(db);
-        FS::RemoveFile(path);
-        Power::Unlock();
-    }
+    // Inserts an icon into slot index of pages[page]. A full page pushes its overflow towards whichever
+    // neighbouring page with a free slot needs the fewest icons to shift.
+    static void Insert(std::vector<std::vector<int>> &pages, unsigned int page, unsigned int index, int icon, unsigned int max) {
+        pages[page].insert(pages[page].begin() + index, icon);
 
-    int Save(std::vector<AppInfoIcon> &entries) {
-        int ret = 0;
-        sqlite3 *db = nullptr;
-        char *error = nullptr;
-        char db_path_backup[] = "ur0:shell/db/app.db.sort.bkp";
-        
-        if (R_FAILED(ret = FS::CopyFile(db_path, db_path_backup))) {
-            return ret;
+        if (pages[page].size() <= max) {
+            return;
         }
 
-        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
-        if (ret != SQLITE_OK) {
-            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
-            FS::RemoveFile(db_path);
-            return ret;
+        int next = -1, prev = -1;
+        for (unsigned int i = page + 1; i < pages.size(); i++) {
+            if (pages[i].size() < max) {
+                next = i;
+                break;
+            }
         }
 
-        // Lock power and prevent auto suspend.
-        Power::Lock();
+        for (int i = static_cast<int>(page) - 1; i >= 0; i--) {
+            if (pages[i].size() < max) {
+                prev = i;
+                break;
+            }
+        }
 
-        const char *prepare_query[] = {
-            "BEGIN TRANSACTION",
-            "PRAGMA foreign_keys = off",
-            "DROP TABLE IF EXISTS tbl_appinfo_icon_sort",
-            "CREATE TABLE tbl_appinfo_icon_sort AS SELECT * FROM tbl_appinfo_icon"
-        };
-        
-        for (int i = 0; i < 4; ++i) {
-            ret = sqlite3_exec(db, prepare_query[i], nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(prepare_query[i], error, db, db_path);
-                return ret;
+        unsigned int next_cost = (next == -1)? UINT_MAX : (pages[page].size() - 1 - index) + max * (next - page - 1) + pages[next].size();
+        unsigned int prev_cost = (prev == -1)? UINT_MAX : index + max * (page - prev - 1);
+
+        if ((next != -1) && (next_cost <= prev_cost)) {
+            for (int i = page; i < next; i++) {
+                pages[i + 1].insert(pages[i + 1].begin(), pages[i].back());
+                pages[i].pop_back();
+            }
+        }
+        else if (prev != -1) {
+            for (int i = page; i > prev; i--) {
+                pages[i - 1].push_back(pages[i].front());
+                pages[i].erase(pages[i].begin());
             }
         }
+    }
+
+    // Moves the icons that are out of order into their sorted place, leaving every other icon in its slot.
+    static void Place(std::vector<std::vector<int>> &pages, unsigned int max) {
+        std::vector<int> ranks;
+        for (const std::vector<int> &page : pages) {
+            ranks.insert(ranks.end(), page.begin(), page.end());
+        }
 
-        // Update tbl_appinfo_icon_sort with sorted icons
-        for (unsigned int i = 0; i < entries.size(); i++) {
-            std::string title = entries[i].title;
-            std::string titleId = entries[i].titleId;
-            std::string reserved01 = entries[i].reserved01;
-            std::string query = std::string("UPDATE tbl_appinfo_icon_sort ")
-                + "SET pageId = " + std::to_string(entries[i].pageId) + ", pos = " + std::to_string(entries[i].pos) + " "
-                + "WHERE ";
-
-            if ((title == "(null)") && (titleId == "(null)")) {
-                // Check if power icon on PSTV, otherwise use reserved01.
-                if (entries[i].icon0Type == 8) {
-                    query.append("icon0Type = " + std::to_string(entries[i].icon0Type) + ";");
+        std::vector<bool> keep = AppList::KeepSorted(ranks);
+        std::vector<int> misplaced;
+
+        for (unsigned int i = 0, slot = 0; i < pages.size(); i++) {
+            std::vector<int> kept;
+
+            for (int rank : pages[i]) {
+                if (keep[slot++]) {
+                    kept.push_back(rank);
                 }
-                else if (reserved01 != "(null)") {
-                    query.append("reserved01 = " + reserved01 + ";");
+                else {
+                    misplaced.push_back(rank);
                 }
             }
-            else {
-                query.append((titleId == "(null)"? "title = \"" + title + "\"" : "titleId = \"" + titleId + "\"")
-                    + (entries[i].icon0Type == 7? " AND reserved01 = " + reserved01 + ";" : ";"));
-            }
 
-            ret = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(query, error, db, db_path);
-
-                // If sorting fails, drop tbl_appinfo_icon_sort.
-                query = std::string("DROP TABLE IF EXISTS tbl_appinfo_icon_sort");
-                int ret_next = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
-                if (ret_next != SQLITE_OK) {
-                    AppList::Error(query, error, db, db_path);
-                    return ret_next;
-                }
+            pages[i] = kept;
+        }
 
-                return ret;
+        std::sort(misplaced.begin(), misplaced.end());
+
+        for (int rank : misplaced) {
+            // Find the last page that starts before this rank, then binary search the slot within it.
+            unsigned int page = 0;
+            for (unsigned int i = 0; i < pages.size(); i++) {
+                if (!pages[i].empty() && (pages[i].front() < rank)) {
+                    page = i;
+                }
             }
-        }
 
-        const char *finish_query[] = {
-            "DROP TABLE tbl_appinfo_icon",
-            "CREATE TABLE tbl_appinfo_icon(pageId REFERENCES tbl_appinfo_page(pageId) ON DELETE RESTRICT NOT NULL, pos INT NOT NULL, iconPath TEXT, title TEXT COLLATE NOCASE, type NOT NULL, command TEXT, titleId TEXT, icon0Type NOT NULL, parentalLockLv INT, status INT, reserved01, reserved02, reserved03, reserved04, reserved05, PRIMARY KEY(pageId, pos))",
-            "CREATE INDEX idx_icon_pos ON tbl_appinfo_icon ( pos, pageId )",
-            "CREATE INDEX idx_icon_title ON tbl_appinfo_icon (title, titleId, type)",
-            "INSERT INTO tbl_appinfo_icon SELECT * FROM tbl_appinfo_icon_sort",
-            "DROP TABLE tbl_appinfo_icon_sort",
-            "PRAGMA foreign_keys = on",
-            "COMMIT"
-        };
+            unsigned int index = std::upper_bound(pages[page].begin(), pages[page].end(), rank) - pages[page].begin();
 
-        for (int i = 0; i < 8; ++i) {
-            ret = sqlite3_exec(db, finish_query[i], nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(finish_query[i], error, db, db_path);
-                return ret;
+            // Between two pages, prefer the next page over a full one.
+            if ((index == pages[page].size()) && (pages[page].size() >= max) && (page + 1 < pages.size()) && (pages[page + 1].size() < max)) {
+                page++;
+                index = 0;
             }
-        }
 
-        Power::Unlock();
-        sqlite3_close(db);
-        return 0;
+            AppList::Insert(pages, page, index, rank, max);
+        }
     }
 
-    int SavePages(std::vector<AppInfoPage> &entries) {
-        int ret = 0;
-        sqlite3 *db = nullptr;
-        char *error = nullptr;
-        char db_path_backup[] = "ur0:shell/db/app.db.sort.bkp";
-        
-        if (R_FAILED(ret = FS::CopyFile(db_path, db_path_backup))) {
-            return ret;
-        }
+    void Place(AppEntries &entries) {
+        const unsigned int MAX_POS = 9;
 
-        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
-        if (ret != SQLITE_OK) {
-            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
-            FS::RemoveFile(db_path);
-            return ret;
+        // An icon's rank is its index in the sorted order. The current layout comes from the positions the icons
+        // were loaded with.
+        std::vector<uint32_t> &order = entries.order;
+        std::vector<AppInfoPage> pages = entries.pages;
+        std::sort(pages.begin(), pages.end(), [](const AppInfoPage &pageA, const AppInfoPage &pageB) {
+            return pageA.origPageNo < pageB.origPageNo;
+        });
+
+        std::unordered_map<int, unsigned int> pageIndexMap;
+        for (unsigned int i = 0; i < pages.size(); i++) {
+            pageIndexMap[pages[i].pageId] = i;
         }
 
-        // Lock power and prevent auto suspend.
-        Power::Lock();
+        std::vector<std::vector<int>> slots(pages.size());
+        std::unordered_map<int, std::vector<int>> folderSlots;
 
-        const char *prepare_query[] = {
-            "BEGIN TRANSACTION",
-            "PRAGMA foreign_keys = off",
-            "DROP TABLE IF EXISTS tbl_appinfo_page_sort",
-            "CREATE TABLE tbl_appinfo_page_sort AS SELECT * FROM tbl_appinfo_page"
-        };
-        
-        for (int i = 0; i < 4; ++i) {
-            ret = sqlite3_exec(db, prepare_query[i], nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(prepare_query[i], error, db, db_path);
-                return ret;
-            }
-        }
+        for (unsigned int rank = 0; rank < order.size(); rank++) {
+            const uint32_t i = order[rank];
 
-        // Update tbl_appinfo_page_sort with swapped pages
-        for (unsigned int i = 0; i < entries.size(); i++) {
-            std::string query = std::string("UPDATE tbl_appinfo_page_sort ")
-                + "SET pageNo = " + std::to_string(entries[i].pageNo) + " WHERE pageId = "
-                + std::to_string(entries[i].pageId) + ";";
+            if ((entries.pageNo[i] < 0) && (cfg.sort_folders != SortAppsOnly)) {
+                folderSlots[entries.origPageId[i]].push_back(rank);
+            }
+            else if ((entries.pageNo[i] >= 0) && (cfg.sort_folders != SortFoldersOnly)) {
+                std::unordered_map<int, unsigned int>::const_iterator it = pageIndexMap.find(entries.origPageId[i]);
 
-            ret = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(query, error, db, db_path);
-
-                // If sorting fails, drop tbl_appinfo_page_sort.
-                query = std::string("DROP TABLE IF EXISTS tbl_appinfo_page_sort");
-                int ret_next = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
-                if (ret_next != SQLITE_OK) {
-                    AppList::Error(query, error, db, db_path);
-                    return ret_next;
+                if (it != pageIndexMap.end()) {
+                    slots[it->second].push_back(rank);
                 }
-
-                return ret;
             }
         }
 
-        const char *finish_query[] = {
-            "DROP TABLE tbl_appinfo_page",
-            "CREATE TABLE tbl_appinfo_page(pageId INTEGER PRIMARY KEY NOT NULL, pageNo INT NOT NULL, themeFile TEXT, bgColor INT, texWidth INT, texHeight INT, imageWidth INT, imageHeight INT, reserved01, reserved02, reserved03, reserved04, reserved05)",
-            "CREATE INDEX idx_page_no ON tbl_appinfo_page ( pageNo )",
-            "INSERT INTO tbl_appinfo_page SELECT * FROM tbl_appinfo_page_sort",
-            "DROP TABLE tbl_appinfo_page_sort",
-            "CREATE TRIGGER tgr_deletePage2 AFTER DELETE ON tbl_appinfo_page WHEN OLD.pageNo >= 0 BEGIN UPDATE tbl_appinfo_page SET pageNo = pageNo - 1 WHERE tbl_appinfo_page.pageNo > OLD.pageNo; END",
-            "CREATE TRIGGER tgr_insertPage2 BEFORE INSERT ON tbl_appinfo_page WHEN NEW.pageNo >= 0 BEGIN UPDATE tbl_appinfo_page SET pageNo = pageNo + 1 WHERE tbl_appinfo_page.pageNo >= NEW.pageNo; END",
-            "PRAGMA foreign_keys = on",
-            "COMMIT"
+        auto byPos = [&entries, &order](int rankA, int rankB) {
+            return entries.origPos[order[rankA]] < entries.origPos[order[rankB]];
         };
 
-        for (int i = 0; i < 9; ++i) {
-            ret = sqlite3_exec(db, finish_query[i], nullptr, nullptr, &error);
-            if (ret != SQLITE_OK) {
-                AppList::Error(finish_query[i], error, db, db_path);
-                return ret;
-            }
+        for (std::vector<int> &page : slots) {
+            std::sort(page.begin(), page.end(), byPos);
         }
 
-        Power::Unlock();
-        sqlite3_close(db);
-        return 0;
-    }
+        AppList::Place(slots, MAX_POS + 1);
 
-    static bool Compare(const std::string &nameA, const std::string &nameB, int sortOrder) {
-        if (sortOrder == SortTitle) {
-            return std::lexicographical_compare(nameA.begin(), nameA.end(), nameB.begin(), nameB.end(), [](char a, char b) {
-                return std::tolower(a) < std::tolower(b);
-            });
+        for (unsigned int i = 0; i < slots.size(); i++) {
+            for (unsigned int j = 0; j < slots[i].size(); j++) {
+                entries.pageId[order[slots[i][j]]] = pages[i].pageId;
+                entries.pageNo[order[slots[i][j]]] = pages[i].origPageNo;
+                entries.pos[order[slots[i][j]]] = j;
+            }
         }
-        else {
-            return nameA < nameB;
+
+        // Folders have no slot limit, so out of order apps only shift the ones after them within the folder.
+        for (auto &folder : folderSlots) {
+            std::vector<std::vector<int>> children = { folder.second };
+            std::sort(children[0].begin(), children[0].end(), byPos);
+            AppList::Place(children, UINT_MAX);
+
+            for (unsigned int j = 0; j < children[0].size(); j++) {
+                entries.pos[order[children[0][j]]] = j;
+            }
         }
     }
 
-    bool SortAppAsc(const AppInfoIcon &entryA, const AppInfoIcon &entryB) {
-        const std::string &entryAName = (cfg.sort_by == SortTitle) ? entryA.title : entryA.titleId;
-        const std::string &entryBName = (cfg.sort_by == SortTitle) ? entryB.title : entryB.titleId;
-        return AppList::Compare(entryAName, entryBName, cfg.sort_by);
-    }
+    int Snapshot(std::vector<unsigned char> &data, AppProgress *progress) {
+        int ret = 0;
+        sqlite3 *db = nullptr;
 
-    bool SortAppDesc(const AppInfoIcon &entryA, const AppInfoIcon &entryB) {
-        const std::string &entryAName = (cfg.sort_by == SortTitle) ? entryA.title : entryA.titleId;
-        const std::string &entryBName = (cfg.sort_by == SortTitle) ? entryB.title : entryB.titleId;
-        return AppList::Compare(entryBName, entryAName, cfg.sort_by);
-    }
+        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            sqlite3_close(db);
+            return ret;
+        }
 
-    bool SortChildAppAsc(const AppInfoChild &entryA, const AppInfoChild &entryB) {
-        const std::string &entryAName = (cfg.sort_by == SortTitle) ? entryA.title : entryA.titleId;
-        const std::string &entryBName = (cfg.sort_by == SortTitle) ? entryB.title : entryB.titleId;
-        return AppList::Compare(entryAName, entryBName, cfg.sort_by);
+        ret = AppList::Snapshot(db, data, progress);
+        sqlite3_close(db);
+        return ret;
     }
 
-    bool SortChildAppDesc(const AppInfoChild &entryA, const AppInfoChild &entryB) {
-        const std::string &entryAName = (cfg.sort_by == SortTitle) ? entryA.title : entryA.titleId;
-        const std::string &entryBName = (cfg.sort_by == SortTitle) ? entryB.title : entryB.titleId;
-        return AppList::Compare(entryBName, entryAName, cfg.sort_by);
-    }
-    
-    void Sort(AppEntries &entries) {
-        const int MAX_POS = 9;
-        int pos = 0, pageCounter = 0;
-        
-        std::unordered_map<int, int> folderIndexMap;
-        for (AppInfoFolder folder : entries.folders) {
-            folderIndexMap[folder.pageId] = folder.index;
+    int Backup(AppProgress *progress) {
+        int ret = 0;
+        sqlite3 *db = nullptr;
+        std::vector<unsigned char> data;
+
+        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, nullptr);
+        if (ret != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            sqlite3_close(db);
+            return ret;
         }
-        
-        for (unsigned int i = 0; i < entries.icons.size(); i++) {
-            // Reset position
-            if (pos > MAX_POS) {
-                pos = 0;
-                pageCounter++;
-            }
-            
-            // App/Game belongs to a folder
-            if ((entries.icons[i].pageNo < 0) && (cfg.sort_folders != SortAppsOnly)) {
-                std::unordered_map<int, int>::const_iterator it = folderIndexMap.find(entries.icons[i].pageId);
 
-                if (it != folderIndexMap.end()) {
-                    entries.icons[i].pos = it->second;
-                    folderIndexMap[entries.icons[i].pageId]++;
-                }
+        ret = AppList::Backup(db, data, progress);
+        sqlite3_close(db);
+        return ret;
+    }
+
+    int Restore(void) {
+        // Newest first: the latest backup, then the first one, each either a manifest or a plain copy.
+        const char *restore_paths[] = {
+            "ux0:data/VITAHomebrewSorter/backup/app.db.manifest",
+            "ux0:data/VITAHomebrewSorter/backup/app.db",
+            "ux0:data/VITAHomebrewSorter/backup/app.db.bkp.manifest",
+            "ux0:data/VITAHomebrewSorter/backup/app.db.bkp"
+        };
+
+        for (const char *restore_path : restore_paths) {
+            if (!FS::FileExists(restore_path)) {
+                continue;
             }
-            else if ((entries.icons[i].pageNo >= 0) && (cfg.sort_folders != SortFoldersOnly)) {
-                entries.icons[i].pos = pos;
-                entries.icons[i].pageId = entries.pages[pageCounter].pageId;
-                pos++;
+
+            if (Store::IsManifest(restore_path)) {
+                return Store::Restore(restore_path);
             }
+
+            FS::CopyStats stats;
+            stats.crc = true;
+            return FS::CopyFile(restore_path, db_path, nullptr, &stats);
         }
+
+        return -1;
     }
 
-    int Backup(void) {
+    // Opens a database file, or the app.db kept in a store manifest as a read-only copy in memory.
+    static int Open(const std::string &path, sqlite3 **db) {
         int ret = 0;
-        std::string backup_path;
-        
-        if (!FS::FileExists("ux0:data/VITAHomebrewSorter/backup/app.db.bkp")) {
-            backup_path = "ux0:data/VITAHomebrewSorter/backup/app.db.bkp";
-        }
-        else {
-            backup_path = "ux0:data/VITAHomebrewSorter/backup/app.db";
-        }
-            
-        if (R_FAILED(ret = FS::CopyFile(db_path, backup_path))) {
+
+        if (!Store::IsManifest(path)) {
+            if ((ret = sqlite3_open_v2(path.c_str(), db, SQLITE_OPEN_READWRITE, nullptr)) != SQLITE_OK) {
+                Log::Error("sqlite3_open_v2 failed to open %s\n", path.c_str());
+            }
+
             return ret;
         }
-            
-        return 0;
-    }
 
-    int Restore(void) {
-        int ret = 0;
-        std::string restore_path;
+        std::vector<unsigned char> data;
+        if (R_FAILED(ret = Store::Read(path, db_path, data))) {
+            return SQLITE_CANTOPEN;
+        }
 
-        if (!FS::FileExists("ux0:data/VITAHomebrewSorter/backup/app.db")) {
-            restore_path = "ux0:data/VITAHomebrewSorter/backup/app.db.bkp";
+        if ((ret = sqlite3_open_v2(":memory:", db, SQLITE_OPEN_READWRITE, nullptr)) != SQLITE_OK) {
+            Log::Error("sqlite3_open_v2 failed to open :memory:\n");
+            return ret;
         }
-        else {
-            restore_path = "ux0:data/VITAHomebrewSorter/backup/app.db";
+
+        unsigned char *bytes = static_cast<unsigned char *>(sqlite3_malloc64(data.size()));
+        if (!bytes) {
+            return SQLITE_NOMEM;
         }
 
-        if (R_FAILED(ret = FS::CopyFile(restore_path, db_path))) {
-            return ret;
+        sceClibMemcpy(bytes, data.data(), data.size());
+
+        if ((ret = sqlite3_deserialize(*db, "main", bytes, data.size(), data.size(), SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_READONLY)) != SQLITE_OK) {
+            Log::Error("sqlite3_deserialize(%s) failed: %s\n", path.c_str(), sqlite3_errstr(ret));
         }
-        
-        return 0;
-    }
 
-    bool Compare(const std::string &db_name) {
-        std::vector<std::string> app_entries;
-        std::vector<std::string> loadout_entries;
-        std::vector<std::string> diff_entries;
+        return ret;
+    }
 
+    // Calls fn(titleIdKey, title) for every icon in the database at path, returns false if it could not be read.
+    template<typename Fn>
+    static bool ForEachIcon(const std::string &path, Fn fn) {
         sqlite3 *db = nullptr;
-        int ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, nullptr);
+        int ret = AppList::Open(path, &db);
         if (ret != SQLITE_OK) {
-            Log::Error("sqlite3_open_v2 failed to open %s\n", db_path);
+            sqlite3_close(db);
             return false;
         }
 
-        const std::string query = "SELECT title FROM tbl_appinfo_icon;";
+        const char query[] = "SELECT titleId, title FROM tbl_appinfo_icon;";
         
         sqlite3_stmt *stmt = nullptr;
-        ret = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+        ret = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
 
         while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-            std::string entry = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            app_entries.push_back(entry);
+            const char *titleId = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+            const char *title = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+            fn(AppList::PackTitleId(titleId? titleId : "(null)"), title? title : "(null)");
         }
         
-        if (ret != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return false;
-        }
-
         sqlite3_finalize(stmt);
         sqlite3_close(db);
+        return (ret == SQLITE_DONE);
+    }
+
+    bool Compare(const std::string &db_name) {
+        // Apps are matched by packed titleId, falling back to the title for folders and other malformed IDs.
+        std::unordered_set<uint64_t> loadout_ids;
+        std::unordered_set<std::string> loadout_titles;
+        bool missing = false, empty = true;
 
         const std::string loadout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + db_name;
-        
-        ret = sqlite3_open_v2(loadout_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr);
-        if (ret != SQLITE_OK) {
-            Log::Error("sqlite3_open_v2 failed to open %s\n", loadout_path.c_str());
+
+        if (!AppList::ForEachIcon(loadout_path, [&](uint64_t key, const char *title) {
+            if (key != InvalidTitleId) {
+                loadout_ids.insert(key);
+            }
+            else {
+                loadout_titles.insert(title);
+            }
+        })) {
             return false;
         }
-        
-        ret = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
 
-        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-            std::string entry = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            loadout_entries.push_back(entry);
-        }
-        
-        if (ret != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+        if (!AppList::ForEachIcon(db_path, [&](uint64_t key, const char *title) {
+            empty = false;
+            if (!missing) {
+                missing = (key != InvalidTitleId)? (loadout_ids.count(key) == 0) : (loadout_titles.count(title) == 0);
+            }
+        })) {
             return false;
         }
-        
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
 
-        if (app_entries.empty() || loadout_entries.empty()) {
+        if (empty || (loadout_ids.empty() && loadout_titles.empty())) {
             return false;
         }
-        
-        std::set_difference(app_entries.begin(), app_entries.end(), loadout_entries.begin(), loadout_entries.end(),
-        std::inserter(diff_entries, diff_entries.begin()));
-        return (diff_entries.size() > 0);
+
+        return missing;
     }
 }
@@ -9,13 +9,13 @@
 #include "log.h"
 #include "utils.h"
 
-#define CONFIG_VERSION 1
+#define CONFIG_VERSION 2
 
 config_t cfg;
 
 namespace Config {
     static constexpr char config_path[] = "ux0:data/VITAHomebrewSorter/config.json";
-    static const char *config_file = "{\n\t\"beta_features\": %s,\n\t\"sort_by\": %d,\n\t\"sort_folders\": %d,\n\t\"sort_mode\": %d,\n\t\"version\": %d\n}";
+    static const char *config_file = "{\n\t\"beta_features\": %s,\n\t\"sort_by\": %d,\n\t\"sort_folders\": %d,\n\t\"sort_mode\": %d,\n\t\"sort_placement\": %d,\n\t\"version\": %d\n}";
     static int config_version_holder = 0;
     
     class Allocator : public sce::Json::MemAllocator {
@@ -35,9 +35,9 @@ namespace Config {
     
     int Save(config_t &config) {
         int ret = 0;
-        std::unique_ptr<char[]> buffer(new char[128]);
-        SceSize len = sceClibSnprintf(buffer.get(), 128, config_file, config.beta_features? "true" : "false",
-            config.sort_by, config.sort_folders, config.sort_mode, CONFIG_VERSION);
+        std::unique_ptr<char[]> buffer(new char[256]);
+        SceSize len = sceClibSnprintf(buffer.get(), 256, config_file, config.beta_features? "true" : "false",
+            config.sort_by, config.sort_folders, config.sort_mode, config.sort_placement, CONFIG_VERSION);
         
         if (R_FAILED(ret = FS::WriteFile(config_path, buffer.get(), len))) {
             return ret;
@@ -101,7 +101,8 @@ namespace Config {
         cfg.sort_by = value.getValue(1).getInteger();
         cfg.sort_folders = value.getValue(2).getInteger();
         cfg.sort_mode = value.getValue(3).getInteger();
-        config_version_holder = value.getValue(4).getInteger();
+        cfg.sort_placement = value.getValue(4).getInteger();
+        config_version_holder = value.getValue(5).getInteger();
 
         init.terminate();
         delete alloc;
@@ -1,13 +1,19 @@
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <malloc.h>
 #include <memory>
 #include <psp2/io/dirent.h>
 #include <psp2/io/fcntl.h>
 #include <psp2/io/stat.h>
 #include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
 #include <vector>
 
+#include "fs.h"
 #include "log.h"
+#include "store.h"
 #include "utils.h"
 
 namespace FS {
@@ -71,7 +77,7 @@ namespace FS {
         return 0;
     }
 
-    static int GetFileSize(const std::string &path, SceOff &size) {
+    int GetFileSize(const std::string &path, SceOff &size) {
         SceIoStat stat;
         int ret = 0;
         
@@ -84,7 +90,7 @@ namespace FS {
         return 0;
     }
 
-    static int ReadFile(const std::string &path, void *data, SceSize size) {
+    int ReadFile(const std::string &path, void *data, SceSize size) {
         int ret = 0, bytes_read = 0;
         SceUID file = 0;
 
@@ -140,38 +146,287 @@ namespace FS {
         return 0;
     }
 
-    int CopyFile(const std::string &src_path, const std::string &dest_path) {
+    int ReplaceFile(const std::string &src_path, const std::string &dest_path) {
+        const std::string old_path = dest_path + ".old";
+        bool moved = false;
         int ret = 0;
-        unsigned char *data = nullptr;
-        SceOff size = 0;
+
+        // dest_path is moved aside rather than removed, so a crash between the two renames leaves dest_path.old for
+        // RecoverFile instead of nothing at all.
+        if (FS::FileExists(dest_path)) {
+            if (FS::FileExists(old_path)) {
+                FS::RemoveFile(old_path);
+            }
+
+            if (R_FAILED(ret = sceIoRename(dest_path.c_str(), old_path.c_str()))) {
+                Log::Error("sceIoRename(%s, %s) failed: 0x%lx\n", dest_path.c_str(), old_path.c_str(), ret);
+                sceIoRemove(src_path.c_str());
+                return ret;
+            }
+
+            moved = true;
+        }
+
+        if (R_FAILED(ret = sceIoRename(src_path.c_str(), dest_path.c_str()))) {
+            Log::Error("sceIoRename(%s, %s) failed: 0x%lx\n", src_path.c_str(), dest_path.c_str(), ret);
+
+            if (moved) {
+                sceIoRename(old_path.c_str(), dest_path.c_str());
+            }
+
+            return ret;
+        }
+
+        if (moved) {
+            FS::RemoveFile(old_path);
+        }
+
+        return 0;
+    }
+
+    int RecoverFile(const std::string &path) {
+        const std::string old_path = path + ".old";
+        int ret = 0;
+
+        if (FS::FileExists(path) || !FS::FileExists(old_path)) {
+            return 0;
+        }
+
+        if (R_FAILED(ret = sceIoRename(old_path.c_str(), path.c_str()))) {
+            Log::Error("sceIoRename(%s, %s) failed: 0x%lx\n", old_path.c_str(), path.c_str(), ret);
+            return ret;
+        }
+
+        Log::Info("Restored %s from an interrupted replace\n", path.c_str());
+        return 0;
+    }
+
+    // Copies run one at a time (they are only started from the confirmation modals), so they share one ring of chunk
+    // buffers that is allocated on first use and kept. Chunks are 256 KiB and 64 byte aligned.
+    static constexpr int copy_slots = 4;
+    static constexpr SceSize copy_align = 64;
+    static constexpr SceSize copy_chunk_size = 256 * 1024;
+    static unsigned char *copy_buffer = nullptr;
+
+    static unsigned char *GetCopyBuffer(void) {
+        if (!copy_buffer) {
+            copy_buffer = static_cast<unsigned char *>(memalign(copy_align, copy_slots * copy_chunk_size));
+        }
+
+        return copy_buffer;
+    }
+
+    static uint32_t Crc32(uint32_t crc, const unsigned char *data, SceSize size) {
+        static uint32_t table[256] = { 0 };
+
+        if (table[1] == 0) {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int j = 0; j < 8; j++) {
+                    c = (c & 1)? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+                }
+
+                table[i] = c;
+            }
+        }
+
+        crc = ~crc;
+        for (SceSize i = 0; i < size; i++) {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+    // Single producer/single consumer ring between the reader thread and the writing caller. The reader only
+    // advances head and the writer only advances tail, so slot [tail, head) belongs to the writer and the rest
+    // to the reader without any lock.
+    struct CopyRing {
+        SceUID src = 0;
+        unsigned char *buffer = nullptr;
+        SceSize chunk = 0;
+        int lengths[copy_slots] = { 0 };
+        std::atomic<uint32_t> head{0};
+        std::atomic<uint32_t> tail{0};
+        std::atomic<bool> done{false}; // Reader reached the end of the file or failed.
+        std::atomic<bool> stop{false}; // Writer gave up, the reader should not read any further.
+        int error = 0;
+        SceUInt64 stall = 0;           // Time the reader spent waiting for a free slot.
+    };
+
+    // Reads the next chunk into the slot at head. Returns false at the end of the file or on error.
+    static bool ReadChunk(CopyRing &ring) {
+        const uint32_t head = ring.head.load(std::memory_order_relaxed);
+        const int slot = head % copy_slots;
+        int bytes_read = sceIoRead(ring.src, ring.buffer + slot * ring.chunk, ring.chunk);
+
+        if (bytes_read <= 0) {
+            ring.error = bytes_read;
+            return false;
+        }
+
+        ring.lengths[slot] = bytes_read;
+        ring.head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    static int CopyReader(SceSize args, void *argp) {
+        CopyRing &ring = **static_cast<CopyRing **>(argp);
+
+        while (!ring.stop.load(std::memory_order_acquire)) {
+            if (ring.head.load(std::memory_order_relaxed) - ring.tail.load(std::memory_order_acquire) == copy_slots) {
+                SceUInt64 start = sceKernelGetProcessTimeWide();
+                sceKernelDelayThread(100);
+                ring.stall += sceKernelGetProcessTimeWide() - start;
+                continue;
+            }
+
+            if (!FS::ReadChunk(ring)) {
+                break;
+            }
+        }
+
+        ring.done.store(true, std::memory_order_release);
+        return 0;
+    }
+
+    // Streams src_path into a temporary file next to dest_path, and only replaces dest_path once every byte has
+    // been written, so a failed or cancelled copy leaves the destination as it was. Reads run on their own thread
+    // so they overlap the writes, which matters when the two paths are on different media (ur0: and ux0:).
+    int CopyFile(const std::string &src_path, const std::string &dest_path, const CopyProgress &progress, CopyStats *stats) {
+        int ret = 0;
+        SceUID dest = 0, reader = 0;
+        SceOff size = 0, copied = 0;
+        SceUInt64 stall = 0;
+        uint32_t crc = 0;
+        CopyRing ring;
+        CopyRing *ring_ptr = &ring;
+        const std::string temp_path = dest_path + ".tmp";
+        SceUInt64 start = sceKernelGetProcessTimeWide();
 
         if (R_FAILED(ret = FS::GetFileSize(src_path, size))) {
             return ret;
         }
 
-        data = new unsigned char[size];
-        if (!data) {
+        if (progress && !progress(0, size)) {
             return -1;
         }
-        
-        if (R_FAILED(ret = FS::ReadFile(src_path, data, size))) {
-            delete[] data;
+
+        if (!(ring.buffer = FS::GetCopyBuffer())) {
+            Log::Error("memalign(%d) failed\n", copy_slots * copy_chunk_size);
+            return -1;
+        }
+
+        ring.chunk = copy_chunk_size;
+
+        if (R_FAILED(ret = ring.src = sceIoOpen(src_path.c_str(), SCE_O_RDONLY, 0))) {
+            Log::Error("sceIoOpen(%s) failed: 0x%lx\n", src_path.c_str(), ret);
             return ret;
         }
-            
-        if (FS::FileExists(dest_path)) {
-            if (R_FAILED(ret = FS::RemoveFile(dest_path))) {
-                delete[] data;
-                return ret;
+
+        if (R_FAILED(ret = dest = sceIoOpen(temp_path.c_str(), SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777))) {
+            Log::Error("sceIoOpen(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            sceIoClose(ring.src);
+            return ret;
+        }
+
+        // Without a reader thread the writer reads each chunk itself whenever the ring runs dry.
+        if (R_SUCCEEDED(reader = sceKernelCreateThread("FS::CopyReader", FS::CopyReader, 0x10000100, 0x4000, 0, 0, nullptr))) {
+            sceKernelStartThread(reader, sizeof(ring_ptr), &ring_ptr);
+        }
+
+        while (true) {
+            const uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+
+            if (tail == ring.head.load(std::memory_order_acquire)) {
+                if (R_FAILED(reader)) {
+                    if (!FS::ReadChunk(ring)) {
+                        break;
+                    }
+                }
+                else if (ring.done.load(std::memory_order_acquire)) {
+                    if (tail == ring.head.load(std::memory_order_acquire)) {
+                        break;
+                    }
+                }
+                else {
+                    SceUInt64 wait = sceKernelGetProcessTimeWide();
+                    sceKernelDelayThread(100);
+                    stall += sceKernelGetProcessTimeWide() - wait;
+                }
+
+                continue;
             }
+
+            const int slot = tail % copy_slots;
+            const unsigned char *data = ring.buffer + slot * ring.chunk;
+            int bytes_written = 0;
+
+            if (R_FAILED(ret = bytes_written = sceIoWrite(dest, data, ring.lengths[slot]))) {
+                Log::Error("sceIoWrite(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+                break;
+            }
+
+            if (stats && stats->crc) {
+                crc = FS::Crc32(crc, data, bytes_written);
+            }
+
+            copied += bytes_written;
+            ring.tail.store(tail + 1, std::memory_order_release);
+
+            if (progress && !progress(copied, size)) {
+                ret = -1;
+                break;
+            }
+        }
+
+        ring.stop.store(true, std::memory_order_release);
+        if (R_SUCCEEDED(reader)) {
+            sceKernelWaitThreadEnd(reader, nullptr, nullptr);
+            sceKernelDeleteThread(reader);
         }
 
-        if (R_FAILED(ret = FS::WriteFile(dest_path, data, size))) {
-            delete[] data;
+        sceIoClose(ring.src);
+
+        if (R_FAILED(ring.error)) {
+            Log::Error("sceIoRead(%s) failed: 0x%lx\n", src_path.c_str(), ring.error);
+            ret = ring.error;
+        }
+
+        if (R_FAILED(ret) || (copied != size)) {
+            sceIoClose(dest);
+            sceIoRemove(temp_path.c_str());
+            return R_FAILED(ret)? ret : -1;
+        }
+
+        if (R_FAILED(ret = sceIoClose(dest))) {
+            Log::Error("sceIoClose(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            sceIoRemove(temp_path.c_str());
             return ret;
         }
 
-        delete[] data;
+        if (R_FAILED(ret = FS::ReplaceFile(temp_path, dest_path))) {
+            return ret;
+        }
+
+        const SceUInt64 elapsed = sceKernelGetProcessTimeWide() - start;
+        char checksum[24] = { 0 };
+        if (stats && stats->crc) {
+            sceClibSnprintf(checksum, sizeof(checksum), ", crc32 %08x", crc);
+        }
+
+        Log::Info("FS::CopyFile(%s, %s): %lld bytes in %llu us (%llu KiB/s), %d KiB chunks, waited %llu us on reads, %llu us on writes%s\n",
+            src_path.c_str(), dest_path.c_str(), size, elapsed, (elapsed > 0)? static_cast<SceUInt64>(size) * 1000000 / 1024 / elapsed : 0,
+            ring.chunk / 1024, stall, ring.stall, checksum);
+
+        if (stats) {
+            stats->bytes = size;
+            stats->usec = elapsed;
+            stats->readStall = stall;
+            stats->writeStall = ring.stall;
+            stats->checksum = crc;
+        }
+
         return 0;
     }
 
@@ -228,7 +483,7 @@ namespace FS {
             ret = sceIoDread(dir, &entry);
             
             if (ret > 0) {
-                if (!FS::IsDBFile(entry.d_name)) {
+                if (!FS::IsDBFile(entry.d_name) && !Store::IsManifest(entry.d_name)) {
                     continue;
                 }
                     
@@ -1,28 +1,136 @@
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <psp2/power.h>
 #include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
 #include <SDL.h>
 
 #include "applist.h"
 #include "config.h"
 #include "fs.h"
+#include "gui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_sdlrenderer2.h"
 #include "imgui_internal.h"
 #include "log.h"
 #include "loadouts.h"
+#include "sqlite3.h"
 #include "tabs.h"
 #include "utils.h"
 
 namespace GUI {
     static bool backupExists = false;
     static const ImVec2 tex_size = ImVec2(20, 20);
+
+    static bool BackupExists(void) {
+        return (FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db.manifest") || FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db.bkp.manifest") ||
+            FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db") || FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db.bkp"));
+    }
     
     static SDL_Window *window;
     static SDL_Renderer *renderer;
 
+    // Filled by Load on a worker thread, and handed to the render loop once ready is set. The loader never touches them again.
+    static AppEntries loaded_entries;
+    static std::vector<SceIoDirent> loaded_loadouts;
+    static std::atomic<bool> ready(false);
+
+    static void Load(int sort_mode) {
+        SceUInt64 start = sceKernelGetProcessTimeWide();
+
+        // Initial sort based on the cfg.sort_mode StartLoad copied
+        AppList::Get(loaded_entries);
+        SceUInt64 get = sceKernelGetProcessTimeWide();
+
+        AppList::Order(loaded_entries, sort_mode);
+        SceUInt64 order = sceKernelGetProcessTimeWide();
+
+        FS::GetDirList("ux0:data/VITAHomebrewSorter/loadouts", loaded_loadouts);
+        SceUInt64 end = sceKernelGetProcessTimeWide();
+
+        Log::Info("GUI::Load: app list %llu us, order %llu us, loadouts %llu us, total %llu us\n", get - start, order - get, end - order, end - start);
+        ready.store(true, std::memory_order_release);
+    }
+
+    static int LoadThread(SceSize args, void *argp) {
+        GUI::Load(*static_cast<int *>(argp));
+        return sceKernelExitDeleteThread(0);
+    }
+
+    static void StartLoad(void) {
+        // The Settings and Sort tabs can change cfg while the loader runs, so it gets its own copy of the sort mode.
+        int sort_mode = cfg.sort_mode;
+        SceUID thread = 0;
+
+        if (R_SUCCEEDED(thread = sceKernelCreateThread("GUI::LoadThread", GUI::LoadThread, 0x10000100, 0x100000, 0, 0, nullptr))) {
+            sceKernelStartThread(thread, sizeof(sort_mode), &sort_mode);
+        }
+        else {
+            Log::Error("sceKernelCreateThread(GUI::LoadThread) failed: 0x%lx\n", thread);
+            GUI::Load(sort_mode);
+        }
+    }
+
+    // Shared with ApplyThread while an apply is running. The render thread only reads progress and sets cancel
+    // until applied is set.
+    static AppChanges changes;
+    static AppProgress progress;
+    static State apply = StateNone;
+    static int apply_result = 0;
+    static std::atomic<bool> applied(false);
+    static SceUID apply_thread = -1; // Kept until the thread has ended, so quitting can wait for it.
+
+    static void Apply(void) {
+        // Save and SavePages keep a snapshot of app.db in the backup store before writing anything.
+        apply_result = (apply == StateConfirmSort)? AppList::Save(changes.icons, &progress) : AppList::SavePages(changes.pages, &progress);
+        applied.store(true, std::memory_order_release);
+    }
+
+    static int ApplyThread(SceSize args, void *argp) {
+        GUI::Apply();
+        return sceKernelExitThread(0);
+    }
+
+    // Waits for ApplyThread to end and deletes it. If cancel is set the apply stops before COMMIT, once COMMIT has
+    // started it is always allowed to finish writing app.db.
+    static void EndApply(bool cancel) {
+        if (apply_thread < 0) {
+            return;
+        }
+
+        if (cancel) {
+            progress.cancel = true;
+        }
+
+        sceKernelWaitThreadEnd(apply_thread, nullptr, nullptr);
+        sceKernelDeleteThread(apply_thread);
+        apply_thread = -1;
+    }
+
+    static void StartApply(State state) {
+        SceUID thread = 0;
+
+        progress.bytes = 0;
+        progress.totalBytes = 0;
+        progress.rows = 0;
+        progress.totalRows = 0;
+        progress.cancel = false;
+        applied = false;
+        apply = state;
+
+        if (R_SUCCEEDED(thread = sceKernelCreateThread("GUI::ApplyThread", GUI::ApplyThread, 0x10000100, 0x100000, 0, 0, nullptr))) {
+            apply_thread = thread;
+            sceKernelStartThread(thread, 0, nullptr);
+        }
+        else {
+            Log::Error("sceKernelCreateThread(GUI::ApplyThread) failed: 0x%lx\n", thread);
+            GUI::Apply();
+        }
+    }
+
     static void SetupPopup(const char *id) {
         ImGui::OpenPopup(id);
         ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tex_size);
@@ -46,10 +154,37 @@ namespace GUI {
     };
 
     static void Prompt(State &state, AppEntries &entries, std::vector<SceIoDirent> &loadouts, const std::string &db_name) {
+        static State planned = StateNone;
+
+        if ((state == StateApplying) && applied.load(std::memory_order_acquire)) {
+            GUI::EndApply(false);
+            // A failed or cancelled apply may have stopped before its backup was written.
+            backupExists = GUI::BackupExists();
+
+            if (apply_result == 0) {
+                if (apply == StateConfirmSort) {
+                    Config::Save(cfg);
+                }
+
+                state = StateDone;
+            }
+            else {
+                // Only an apply stopped before COMMIT counts as cancelled, Cancel can still be pressed after it.
+                state = (apply_result == SQLITE_INTERRUPT)? StateNone : StateError;
+            }
+        }
+
         if (state == StateNone) {
+            planned = StateNone;
             return;
         }
-        
+
+        // Work out which rows actually move once, when the confirmation is first shown.
+        if ((state != planned) && ((state == StateConfirmSort) || (state == StateConfirmSwap))) {
+            AppList::Plan(entries, changes);
+        }
+
+        planned = state;
         std::string title, prompt;
 
         switch (state) {
@@ -93,6 +228,11 @@ namespace GUI {
                 prompt = "An error occured and has been logged. The app will restore your app.db backup.";
                 break;
 
+            case StateApplying:
+                title = "Applying";
+                prompt = "Please wait while app.db is backed up and updated.";
+                break;
+
             default:
                 break;
         }
@@ -102,6 +242,15 @@ namespace GUI {
         if (ImGui::BeginPopupModal(title.c_str(), nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
             ImGui::Text(prompt.c_str());
 
+            if (state == StateConfirmSort) {
+                ImGui::Dummy(ImVec2(0.0f, 5.0f));
+                ImGui::Text("%d icon(s) will be moved.", static_cast<int>(changes.icons.size()));
+            }
+            else if (state == StateConfirmSwap) {
+                ImGui::Dummy(ImVec2(0.0f, 5.0f));
+                ImGui::Text("%d page(s) will be moved.", static_cast<int>(changes.pages.size()));
+            }
+
             if ((state == StateConfirmSort) || (state == StateRestore) || (state == StateLoadoutRestore)) {
                 ImGui::Dummy(ImVec2(0.0f, 5.0f));
                 ImGui::Text("You must reboot your device for the changes to take effect.");
@@ -110,32 +259,48 @@ namespace GUI {
                 ImGui::Dummy(ImVec2(0.0f, 5.0f));
                 ImGui::Text("Do you still wish to continue restoring this loadout?");
             }
+            else if (state == StateApplying) {
+                char overlay[64];
+                float fraction = 0.0f;
+                const uint32_t rows = progress.rows, totalRows = progress.totalRows;
+                const int64_t bytes = progress.bytes, totalBytes = progress.totalBytes;
+
+                // Rows are only counted once the backups are done.
+                if (totalRows == 0) {
+                    fraction = (totalBytes > 0)? static_cast<float>(bytes) / totalBytes : 0.0f;
+                    sceClibSnprintf(overlay, sizeof(overlay), "Backing up %lld / %lld KB", bytes / 1024, totalBytes / 1024);
+                }
+                else {
+                    fraction = static_cast<float>(std::min(rows, totalRows)) / totalRows;
+                    sceClibSnprintf(overlay, sizeof(overlay), "Writing %u / %u rows", std::min(rows, totalRows), totalRows);
+                }
+
+                ImGui::Dummy(ImVec2(0.0f, 5.0f));
+                ImGui::ProgressBar(fraction, ImVec2(400.0f, 0.0f), overlay);
+            }
 
             ImGui::Dummy(ImVec2(0.0f, 5.0f));
 
-            if (ImGui::Button("Ok", ImVec2(120, 0))) {
+            if ((state != StateApplying) && ImGui::Button("Ok", ImVec2(120, 0))) {
                 switch (state) {
                     case StateConfirmSort:
-                        AppList::Backup();
-                        backupExists = true;
-                        if ((AppList::Save(entries.icons)) == 0) {
-                            Config::Save(cfg);
-                            state = StateDone;
-                        }
-                        else {
-                            state = StateError;
+                        if (changes.icons.empty()) {
+                            state = StateNone;
+                            break;
                         }
+
+                        GUI::StartApply(state);
+                        state = StateApplying;
                         break;
 
                     case StateConfirmSwap:
-                        AppList::Backup();
-                        backupExists = true;
-                        if ((AppList::SavePages(entries.pages)) == 0) {
-                            state = StateDone;
-                        }
-                        else {
-                            state = StateError;
+                        if (changes.pages.empty()) {
+                            state = StateNone;
+                            break;
                         }
+
+                        GUI::StartApply(state);
+                        state = StateApplying;
                         break;
 
                     case StateRestore:
@@ -179,11 +344,22 @@ namespace GUI {
                 ImGui::CloseCurrentPopup();
             }
 
-            ImGui::SameLine(0.0f, 15.0f);
+            if (state == StateApplying) {
+                // The worker rolls back and the state changes once it has stopped.
+                const bool cancelling = progress.cancel.load();
+                GUI::DisableButtonInit(cancelling);
+                if (ImGui::Button("Cancel", ImVec2(120, 0))) {
+                    progress.cancel = true;
+                }
+                GUI::DisableButtonExit(cancelling);
+            }
+            else {
+                ImGui::SameLine(0.0f, 15.0f);
 
-            if (ImGui::Button("Cancel", ImVec2(120, 0))) {
-                ImGui::CloseCurrentPopup();
-                state = StateNone;
+                if (ImGui::Button("Cancel", ImVec2(120, 0))) {
+                    ImGui::CloseCurrentPopup();
+                    state = StateNone;
+                }
             }
         }
 
@@ -337,17 +513,13 @@ namespace GUI {
         bool done = false;
         ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
-        backupExists = (FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db") || FS::FileExists("ux0:/data/VITAHomebrewSorter/backup/app.db.bkp"));
+        backupExists = GUI::BackupExists();
         
         AppEntries entries;
         std::vector<SceIoDirent> loadouts;
+        bool loading = true;
         
-        // Initial sort based on cfg.sort_mode
-        AppList::Get(entries);
-        std::sort(entries.icons.begin(), entries.icons.end(), cfg.sort_mode == SortAsc? AppList::SortAppDesc : AppList::SortAppDesc);
-        std::sort(entries.child_apps.begin(), entries.child_apps.end(), cfg.sort_mode == SortAsc? AppList::SortChildAppDesc : AppList::SortChildAppDesc);
-        
-        FS::GetDirList("ux0:data/VITAHomebrewSorter/loadouts", loadouts);
+        GUI::StartLoad();
         
         int date_format = Utils::GetDateFormat();
         
@@ -380,26 +552,49 @@ namespace GUI {
                 }
             }
 
+            if (loading && ready.load(std::memory_order_acquire)) {
+                entries = std::move(loaded_entries);
+                loadouts = std::move(loaded_loadouts);
+                loading = false;
+            }
+
             GUI::Begin();
             GUI::SetupWindow();
 
             if (ImGui::Begin("VITA Homebrew Sorter", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse)) {
                 if (ImGui::BeginTabBar("VITA Homebrew Sorter tabs")) {
-                    Tabs::Sort(entries, state, backupExists);
-                    Tabs::Pages(entries, state, backupExists);
-                    GUI::DisableButtonInit(!cfg.beta_features);
-                    Tabs::Loadouts(loadouts, state, date_format, loadout_name);
-                    GUI::DisableButtonExit(!cfg.beta_features);
+                    if (loading) {
+                        // Same label as the Sort tab, so it stays selected once the app list is swapped in.
+                        if (ImGui::BeginTabItem("Sort/Backup")) {
+                            ImGui::Dummy(ImVec2(0.0f, 5.0f)); // Spacing
+                            ImGui::Text("Loading app list...");
+                            ImGui::EndTabItem();
+                        }
+                    }
+                    else {
+                        Tabs::Sort(entries, state, backupExists);
+                        Tabs::Pages(entries, state, backupExists);
+                        GUI::DisableButtonInit(!cfg.beta_features);
+                        Tabs::Loadouts(loadouts, state, date_format, loadout_name);
+                        GUI::DisableButtonExit(!cfg.beta_features);
+                    }
+
                     Tabs::Settings();
                     ImGui::EndTabBar();
                 }
             }
 
             GUI::ExitWindow();
-            GUI::Prompt(state, entries, loadouts, loadout_name.c_str());
+
+            if (!loading) {
+                GUI::Prompt(state, entries, loadouts, loadout_name.c_str());
+            }
+
             GUI::End(io, clear_color, renderer);
         }
 
+        // Quitting mid-apply must not kill ApplyThread while it writes app.db.
+        GUI::EndApply(true);
         return 0;
     }
 }
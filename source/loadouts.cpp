@@ -1,5 +1,7 @@
+#include "applist.h"
 #include "fs.h"
 #include "keyboard.h"
+#include "store.h"
 #include "utils.h"
 
 namespace Loadouts {
@@ -11,6 +13,12 @@ namespace Loadouts {
         return raw_filename;
     }
 
+    // Loadouts are store manifests holding app.db and iconlayout.ini. Loadouts saved before the store are a .db and
+    // .ini pair, and are still restored and deleted as such.
+    static std::string ManifestPath(const std::string &name) {
+        return "ux0:data/VITAHomebrewSorter/loadouts/" + name + ".manifest";
+    }
+
     int Backup(void) {
         int ret = 0;
         std::string filename = Keyboard::GetText("Enter loadout name");
@@ -21,14 +29,28 @@ namespace Loadouts {
 
         // In the case user adds an extension, remove it.
         filename = Loadouts::StripExt(filename);
-        const std::string loadout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + filename + ".db";
-        const std::string layout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + filename + ".ini";
 
-        if (R_FAILED(ret = FS::CopyFile(db_path, loadout_path))) {
+        std::vector<unsigned char> db;
+        if (R_FAILED(ret = AppList::Snapshot(db))) {
+            return ret;
+        }
+
+        SceOff size = 0;
+        if (R_FAILED(ret = FS::GetFileSize(ini_path, size))) {
             return ret;
         }
 
-        if (R_FAILED(ret = FS::CopyFile(ini_path, layout_path))) {
+        std::vector<unsigned char> layout(size);
+        if ((ret = FS::ReadFile(ini_path, layout.data(), size)) != size) {
+            return R_FAILED(ret)? ret : -1;
+        }
+
+        const std::vector<Store::File> files = {
+            { db_path, db.data(), static_cast<SceOff>(db.size()) },
+            { ini_path, layout.data(), size }
+        };
+
+        if (R_FAILED(ret = Store::Write(Loadouts::ManifestPath(filename), files))) {
             return ret;
         }
         
@@ -40,14 +62,23 @@ namespace Loadouts {
 
         // Remove extension and append it manually.
         const std::string raw_filename = Loadouts::StripExt(filename);
+        const std::string manifest_path = Loadouts::ManifestPath(raw_filename);
+
+        if (FS::FileExists(manifest_path)) {
+            return Store::Restore(manifest_path);
+        }
+
         const std::string loadout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + raw_filename + ".db";
         const std::string layout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + raw_filename + ".ini";
 
-        if (R_FAILED(ret = FS::CopyFile(loadout_path, db_path))) {
+        FS::CopyStats stats;
+        stats.crc = true;
+
+        if (R_FAILED(ret = FS::CopyFile(loadout_path, db_path, nullptr, &stats))) {
             return ret;
         }
 
-        if (R_FAILED(ret = FS::CopyFile(layout_path, ini_path))) {
+        if (R_FAILED(ret = FS::CopyFile(layout_path, ini_path, nullptr, &stats))) {
             return ret;
         }
         
@@ -59,6 +90,12 @@ namespace Loadouts {
 
         // Remove extension and append it manually.
         const std::string raw_filename = Loadouts::StripExt(filename);
+        const std::string manifest_path = Loadouts::ManifestPath(raw_filename);
+
+        if (FS::FileExists(manifest_path)) {
+            return Store::Remove(manifest_path);
+        }
+
         const std::string loadout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + raw_filename + ".db";
         const std::string layout_path = "ux0:data/VITAHomebrewSorter/loadouts/" + raw_filename + ".ini";
 
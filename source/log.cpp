@@ -5,6 +5,7 @@
 #include <cstdio>
 
 #include "fs.h"
+#include "log.h"
 #include "utils.h"
 
 namespace Log {
@@ -44,4 +45,21 @@ namespace Log {
             return;
         }
     }
+
+    void Info(const char *data, ...) {
+        char buf[512];
+        va_list args;
+        va_start(args, data);
+        sceClibVsnprintf(buf, sizeof(buf), data, args);
+        va_end(args);
+        
+        std::string info_string = "[INFO] ";
+        info_string.append(buf);
+        
+        sceClibPrintf("%s\n", info_string.c_str());
+
+        if (R_FAILED(sceIoWrite(log_file, info_string.data(), info_string.length()))) {
+            return;
+        }
+    }
 }
@@ -28,6 +28,7 @@ namespace Services {
         Textures::Init();
         Power::InitThread();
         Config::Load();
+        FS::RecoverFile(db_path);
     }
 
     void Exit(void) {
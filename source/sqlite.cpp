@@ -1,13 +1,17 @@
 #include "sqlite3.h"
 
 #include <assert.h>
+#include <atomic>
 #include <psp2/io/fcntl.h>
 #include <psp2/io/stat.h>
 #include <psp2/kernel/clib.h>
 #include <psp2/kernel/threadmgr.h>
 #include <psp2/rtc.h>
+#include <stdlib.h>
 //#include <unistd.h>
 
+#include "log.h"
+
 #define MAXPATHNAME 512
 
 /*
@@ -17,11 +21,87 @@
 # define SQLITE_PSP2VFS_BUFFERSZ 8192
 #endif
 
+/*
+** Read cache of main database files. Each file caches up to
+** SQLITE_PSP2VFS_CACHESZ aligned blocks of SQLITE_PSP2VFS_CACHE_BLOCKSZ bytes,
+** evicting the least recently used. A SQLITE_PSP2VFS_CACHESZ of 0 disables it.
+*/
+#ifndef SQLITE_PSP2VFS_CACHESZ
+# define SQLITE_PSP2VFS_CACHESZ 256
+#endif
+
+#ifndef SQLITE_PSP2VFS_CACHE_BLOCKSZ
+# define SQLITE_PSP2VFS_CACHE_BLOCKSZ 4096
+#endif
+
+/*
+** Writes to main database files are held back as whole pages until xSync,
+** up to SQLITE_PSP2VFS_DIRTYSZ bytes, then written out in offset order with
+** one write per contiguous run. A SQLITE_PSP2VFS_DIRTYSZ of 0 disables it.
+*/
+#ifndef SQLITE_PSP2VFS_DIRTYSZ
+# define SQLITE_PSP2VFS_DIRTYSZ (4 * 1024 * 1024)
+#endif
+
 /*
 ** The maximum pathname length supported by this VFS.
 */
 #define MAXPATHNAME 512
 
+#define ROUND8(x) (((x) + 7) & ~7)
+
+/*
+** Blocks cached for one file. Every slot is always on the LRU list, most
+** recently used at iHead. Slots that hold a block (aOfst >= 0) are also on the
+** chain of their hash bucket. A slot whose read failed is left empty at the
+** tail, so it is the next one reused.
+*/
+typedef struct PSP2Cache PSP2Cache;
+
+struct PSP2Cache {
+    int nBlock;                         /* Number of slots */
+    int nHash;                          /* Number of hash buckets */
+    int iHead;                          /* Most recently used slot */
+    int iTail;                          /* Least recently used slot */
+    unsigned int iGen;                  /* psp2WriteGen the blocks are valid for */
+    unsigned int nHit;                  /* Blocks found in the cache */
+    unsigned int nMiss;                 /* Blocks read from the file */
+    unsigned int nBypass;               /* Reads that did not go through the cache */
+    sqlite3_int64 *aOfst;               /* File offset of each slot, -1 if empty */
+    int *aPrev;                         /* LRU list */
+    int *aNext;
+    int *aChain;                        /* Next slot in the same hash bucket, -1 ends */
+    int *aBucket;                       /* First slot in each hash bucket, -1 if empty */
+    char *aData;                        /* nBlock blocks of data */
+};
+
+/*
+** Pages written to a main database file and not yet passed on to it. Only
+** writes of exactly nPage bytes at a multiple of nPage are held, so two held
+** pages never partly overlap. Page i lives at aData[i * nPage].
+*/
+typedef struct PSP2Dirty PSP2Dirty;
+
+struct PSP2Dirty {
+    int nPage;                          /* Page size, set by the first held write */
+    int nEntry;                         /* Pages held */
+    int nAlloc;                         /* Pages there is room for */
+    int nHash;                          /* Number of hash buckets, 2 * nAlloc */
+    sqlite3_int64 iEnd;                 /* End of the furthest held page */
+    unsigned int nHeld;                 /* Writes held back */
+    unsigned int nFlush;                /* Writes issued to flush them */
+    sqlite3_int64 *aOfst;               /* File offset of each page */
+    int *aChain;                        /* Next page in the same hash bucket, -1 ends */
+    int *aBucket;                       /* First page in each hash bucket, -1 if empty */
+    char *aData;                        /* Page contents */
+};
+
+/*
+** Bumped on every write to a main database file. A cache whose iGen differs
+** may hold blocks that were written through another handle, and is emptied.
+*/
+static std::atomic<unsigned int> psp2WriteGen(0);
+
 /*
 ** When using this VFS, the sqlite3_file* handles that SQLite uses are
 ** actually pointers to instances of type PSP2File.
@@ -31,25 +111,173 @@ typedef struct PSP2File PSP2File;
 struct PSP2File {
     sqlite3_file base = {0};            /* Base class. Must be first. */
     SceUID fd = 0;                      /* File descriptor */
+    const char *zName = nullptr;        /* Path the file was opened with */
     char *aBuffer = nullptr;            /* Pointer to malloc'd buffer */
     int nBuffer = 0;                    /* Valid bytes of data in zBuffer */
     sqlite3_int64 iBufferOfst = 0;      /* Offset in file of zBuffer[0] */
+    PSP2Cache *pCache = nullptr;        /* Read cache, main database files only */
+    PSP2Dirty *pDirty = nullptr;        /* Held writes, main database files only */
 };
 
+/*
+** Allocate an empty cache, or return 0 if it is disabled or out of memory.
+** Everything lives in one allocation that is released with sqlite3_free().
+*/
+static PSP2Cache *psp2CacheOpen(void) {
+    const int nBlock = SQLITE_PSP2VFS_CACHESZ;
+    const int nHash = nBlock * 2;
+    PSP2Cache *c = 0;
+    char *z = 0;
+    
+    if (nBlock <= 0) {
+        return 0;
+    }
+    
+    z = reinterpret_cast<char*>(sqlite3_malloc64(ROUND8(sizeof(PSP2Cache)) + ROUND8(nBlock * sizeof(sqlite3_int64)) +
+        ROUND8(nBlock * 3 * sizeof(int)) + ROUND8(nHash * sizeof(int)) + static_cast<sqlite3_int64>(nBlock) * SQLITE_PSP2VFS_CACHE_BLOCKSZ));
+    if (!z) {
+        return 0;
+    }
+    
+    c = reinterpret_cast<PSP2Cache*>(z);
+    z += ROUND8(sizeof(PSP2Cache));
+    c->aOfst = reinterpret_cast<sqlite3_int64*>(z);
+    z += ROUND8(nBlock * sizeof(sqlite3_int64));
+    c->aPrev = reinterpret_cast<int*>(z);
+    c->aNext = c->aPrev + nBlock;
+    c->aChain = c->aNext + nBlock;
+    z += ROUND8(nBlock * 3 * sizeof(int));
+    c->aBucket = reinterpret_cast<int*>(z);
+    z += ROUND8(nHash * sizeof(int));
+    c->aData = z;
+    
+    c->nBlock = nBlock;
+    c->nHash = nHash;
+    c->nHit = c->nMiss = c->nBypass = 0;
+    
+    for (int i = 0; i < nBlock; i++) {
+        c->aPrev[i] = i - 1;
+        c->aNext[i] = (i + 1 < nBlock)? i + 1 : -1;
+        c->aOfst[i] = -1;
+    }
+    
+    c->iHead = 0;
+    c->iTail = nBlock - 1;
+    sceClibMemset(c->aBucket, 0xFF, nHash * sizeof(int));
+    c->iGen = psp2WriteGen.load();
+    return c;
+}
+
+/*
+** Drop every cached block.
+*/
+static void psp2CacheReset(PSP2Cache *c) {
+    for (int i = 0; i < c->nBlock; i++) {
+        c->aOfst[i] = -1;
+    }
+    
+    sceClibMemset(c->aBucket, 0xFF, c->nHash * sizeof(int));
+}
+
+static int psp2CacheBucket(PSP2Cache *c, sqlite3_int64 iBlock) {
+    return static_cast<int>((iBlock / SQLITE_PSP2VFS_CACHE_BLOCKSZ) % c->nHash);
+}
+
+static int psp2CacheFind(PSP2Cache *c, sqlite3_int64 iBlock) {
+    int i = c->aBucket[psp2CacheBucket(c, iBlock)];
+    
+    while (i >= 0 && c->aOfst[i] != iBlock) {
+        i = c->aChain[i];
+    }
+    
+    return i;
+}
+
+/*
+** Move slot i to the head of the LRU list.
+*/
+static void psp2CacheTouch(PSP2Cache *c, int i) {
+    if (c->iHead == i) {
+        return;
+    }
+    
+    c->aNext[c->aPrev[i]] = c->aNext[i];
+    if (c->aNext[i] >= 0) {
+        c->aPrev[c->aNext[i]] = c->aPrev[i];
+    }
+    else {
+        c->iTail = c->aPrev[i];
+    }
+    
+    c->aPrev[i] = -1;
+    c->aNext[i] = c->iHead;
+    c->aPrev[c->iHead] = i;
+    c->iHead = i;
+}
+
+/*
+** Take the least recently used slot off its hash chain and return it empty.
+*/
+static int psp2CacheEvict(PSP2Cache *c) {
+    int i = c->iTail;
+    
+    if (c->aOfst[i] >= 0) {
+        int *pLink = &c->aBucket[psp2CacheBucket(c, c->aOfst[i])];
+        
+        while (*pLink != i) {
+            pLink = &c->aChain[*pLink];
+        }
+        
+        *pLink = c->aChain[i];
+        c->aOfst[i] = -1;
+    }
+    
+    return i;
+}
+
+static void psp2CacheInsert(PSP2Cache *c, int i, sqlite3_int64 iBlock) {
+    int iBucket = psp2CacheBucket(c, iBlock);
+    c->aOfst[i] = iBlock;
+    c->aChain[i] = c->aBucket[iBucket];
+    c->aBucket[iBucket] = i;
+    psp2CacheTouch(c, i);
+}
+
+/*
+** Copy data being written over any cached blocks it overlaps, so the cache
+** never holds older data than the file.
+*/
+static void psp2CacheWrite(PSP2Cache *c, const void *zBuf, int iAmt, sqlite3_int64 iOfst) {
+    const char *z = static_cast<const char*>(zBuf);
+    
+    while (iAmt > 0) {
+        sqlite3_int64 iBlock = iOfst - iOfst % SQLITE_PSP2VFS_CACHE_BLOCKSZ;
+        int iStart = static_cast<int>(iOfst - iBlock);
+        int n = SQLITE_PSP2VFS_CACHE_BLOCKSZ - iStart;
+        int i = 0;
+        
+        if (n > iAmt) {
+            n = iAmt;
+        }
+        
+        if ((i = psp2CacheFind(c, iBlock)) >= 0) {
+            sceClibMemcpy(&c->aData[static_cast<sqlite3_int64>(i) * SQLITE_PSP2VFS_CACHE_BLOCKSZ + iStart], z, n);
+        }
+        
+        z += n;
+        iOfst += n;
+        iAmt -= n;
+    }
+}
+
 /*
 ** Write directly to the file passed as the first argument. Even if the
 ** file has a write-buffer (PSP2File.aBuffer), ignore it.
 */
 static int psp2DirectWrite(PSP2File *p, const void *zBuf, int iAmt, sqlite_int64 iOfst) {
-    off_t ofst = 0;                    /* Return value from sceIoLseek() */
-    int nWrite = 0;                    /* Return value from sceIoWrite() */
+    int nWrite = 0;                    /* Return value from sceIoPwrite() */
     
-    ofst = sceIoLseek(p->fd, iOfst, SCE_SEEK_SET);
-    if (ofst != iOfst) {
-        return SQLITE_IOERR_WRITE;
-    }
-        
-    nWrite = sceIoWrite(p->fd, zBuf, iAmt);
+    nWrite = sceIoPwrite(p->fd, zBuf, iAmt, iOfst);
     if (nWrite != iAmt) {
         return SQLITE_IOERR_WRITE;
     }
@@ -73,6 +301,280 @@ static int psp2FlushBuffer(PSP2File *p) {
     return rc;
 }
 
+static int psp2DirtyBucket(PSP2Dirty *d, sqlite3_int64 iOfst) {
+    return static_cast<int>((iOfst / d->nPage) % d->nHash);
+}
+
+static int psp2DirtyFind(PSP2Dirty *d, sqlite3_int64 iOfst) {
+    int i = 0;
+    
+    if (d->nEntry == 0) {
+        return -1;
+    }
+    
+    i = d->aBucket[psp2DirtyBucket(d, iOfst)];
+    while (i >= 0 && d->aOfst[i] != iOfst) {
+        i = d->aChain[i];
+    }
+    
+    return i;
+}
+
+/*
+** Return true if any held page overlaps the given range.
+*/
+static bool psp2DirtyOverlaps(PSP2Dirty *d, sqlite3_int64 iOfst, int iAmt) {
+    if (d->nEntry == 0) {
+        return false;
+    }
+    
+    for (sqlite3_int64 i = iOfst - iOfst % d->nPage; i < iOfst + iAmt; i += d->nPage) {
+        if (psp2DirtyFind(d, i) >= 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/*
+** Copy the held pages that overlap the n bytes of file at iOfst over aBuf,
+** which was just read from the file and so still has their old contents.
+*/
+static void psp2DirtyOverlay(PSP2Dirty *d, char *aBuf, sqlite3_int64 iOfst, int n) {
+    if (!d || d->nEntry == 0) {
+        return;
+    }
+    
+    for (sqlite3_int64 iPage = iOfst - iOfst % d->nPage; iPage < iOfst + n; iPage += d->nPage) {
+        int i = psp2DirtyFind(d, iPage);
+        
+        if (i >= 0) {
+            sqlite3_int64 iStart = (iPage > iOfst)? iPage : iOfst;
+            sqlite3_int64 iEnd = (iPage + d->nPage < iOfst + n)? iPage + d->nPage : iOfst + n;
+            sceClibMemcpy(&aBuf[iStart - iOfst], &d->aData[static_cast<sqlite3_int64>(i) * d->nPage + (iStart - iPage)], iEnd - iStart);
+        }
+    }
+}
+
+/*
+** Make room for at least nAlloc pages and rebuild the hash table.
+*/
+static int psp2DirtyGrow(PSP2Dirty *d, int nAlloc) {
+    sqlite3_int64 *aOfst = reinterpret_cast<sqlite3_int64*>(sqlite3_realloc64(d->aOfst, nAlloc * sizeof(sqlite3_int64)));
+    if (!aOfst) {
+        return SQLITE_NOMEM;
+    }
+    d->aOfst = aOfst;
+    
+    char *aData = reinterpret_cast<char*>(sqlite3_realloc64(d->aData, static_cast<sqlite3_int64>(nAlloc) * d->nPage));
+    if (!aData) {
+        return SQLITE_NOMEM;
+    }
+    d->aData = aData;
+    
+    int *aChain = reinterpret_cast<int*>(sqlite3_realloc64(d->aChain, (nAlloc + nAlloc * 2) * sizeof(int)));
+    if (!aChain) {
+        return SQLITE_NOMEM;
+    }
+    d->aChain = aChain;
+    d->aBucket = aChain + nAlloc;
+    d->nAlloc = nAlloc;
+    d->nHash = nAlloc * 2;
+    
+    sceClibMemset(d->aBucket, 0xFF, d->nHash * sizeof(int));
+    for (int i = 0; i < d->nEntry; i++) {
+        int iBucket = psp2DirtyBucket(d, d->aOfst[i]);
+        d->aChain[i] = d->aBucket[iBucket];
+        d->aBucket[iBucket] = i;
+    }
+    
+    return SQLITE_OK;
+}
+
+static int psp2DirtyCompare(const void *pA, const void *pB) {
+    const sqlite3_int64 a = *static_cast<const sqlite3_int64*>(pA);
+    const sqlite3_int64 b = *static_cast<const sqlite3_int64*>(pB);
+    return (a < b)? -1 : (a > b)? 1 : 0;
+}
+
+/*
+** Write every held page out in offset order, one write per run of adjacent
+** pages, and forget them.
+*/
+static int psp2FlushDirty(PSP2File *p) {
+    PSP2Dirty *d = p->pDirty;
+    sqlite3_int64 *aOrder = 0;
+    char *aRun = 0;
+    int rc = SQLITE_OK;
+    
+    if (!d || d->nEntry == 0) {
+        return SQLITE_OK;
+    }
+    
+    /* Pairs of (offset, index) so the sort carries each page along with its offset. */
+    aOrder = reinterpret_cast<sqlite3_int64*>(sqlite3_malloc64(d->nEntry * 2 * sizeof(sqlite3_int64)));
+    aRun = reinterpret_cast<char*>(sqlite3_malloc64(static_cast<sqlite3_int64>(d->nEntry) * d->nPage));
+    
+    if (!aOrder || !aRun) {
+        /* Not enough memory to sort, write the pages as they are. */
+        for (int i = 0; i < d->nEntry && rc == SQLITE_OK; i++) {
+            rc = psp2DirectWrite(p, &d->aData[static_cast<sqlite3_int64>(i) * d->nPage], d->nPage, d->aOfst[i]);
+            d->nFlush++;
+            
+            if (p->pCache) {
+                psp2CacheWrite(p->pCache, &d->aData[static_cast<sqlite3_int64>(i) * d->nPage], d->nPage, d->aOfst[i]);
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < d->nEntry; i++) {
+            aOrder[i * 2] = d->aOfst[i];
+            aOrder[i * 2 + 1] = i;
+        }
+        
+        qsort(aOrder, d->nEntry, 2 * sizeof(sqlite3_int64), psp2DirtyCompare);
+        
+        for (int i = 0; i < d->nEntry && rc == SQLITE_OK;) {
+            int n = 0;
+            
+            while (i + n < d->nEntry && aOrder[(i + n) * 2] == aOrder[i * 2] + static_cast<sqlite3_int64>(n) * d->nPage) {
+                sceClibMemcpy(&aRun[static_cast<sqlite3_int64>(n) * d->nPage], &d->aData[aOrder[(i + n) * 2 + 1] * d->nPage], d->nPage);
+                n++;
+            }
+            
+            rc = psp2DirectWrite(p, aRun, n * d->nPage, aOrder[i * 2]);
+            d->nFlush++;
+            
+            /* Cached blocks already match what is held, this keeps them that way
+            ** whatever was cached since.
+            */
+            if (p->pCache) {
+                psp2CacheWrite(p->pCache, aRun, n * d->nPage, aOrder[i * 2]);
+            }
+            i += n;
+        }
+    }
+    
+    sqlite3_free(aOrder);
+    sqlite3_free(aRun);
+    
+    d->nEntry = 0;
+    d->iEnd = 0;
+    sceClibMemset(d->aBucket, 0xFF, d->nHash * sizeof(int));
+    return rc;
+}
+
+/*
+** Hold a write back until the next flush. Writes that are not a whole
+** aligned page flush what is held and go straight to the file.
+*/
+static int psp2DirtyWrite(PSP2File *p, const void *zBuf, int iAmt, sqlite_int64 iOfst) {
+    PSP2Dirty *d = p->pDirty;
+    int rc = SQLITE_OK;
+    int i = 0;
+    
+    if (d->nPage == 0 && iAmt >= 512 && (iAmt & (iAmt - 1)) == 0 && iAmt <= SQLITE_PSP2VFS_DIRTYSZ) {
+        d->nPage = iAmt;
+    }
+    
+    if (iAmt != d->nPage || iOfst % d->nPage) {
+        rc = psp2FlushDirty(p);
+        return (rc == SQLITE_OK)? psp2DirectWrite(p, zBuf, iAmt, iOfst) : rc;
+    }
+    
+    if ((i = psp2DirtyFind(d, iOfst)) >= 0) {
+        sceClibMemcpy(&d->aData[static_cast<sqlite3_int64>(i) * d->nPage], zBuf, iAmt);
+        d->nHeld++;
+        return SQLITE_OK;
+    }
+    
+    if (static_cast<sqlite3_int64>(d->nEntry + 1) * d->nPage > SQLITE_PSP2VFS_DIRTYSZ) {
+        if ((rc = psp2FlushDirty(p)) != SQLITE_OK) {
+            return rc;
+        }
+    }
+    
+    if (d->nEntry == d->nAlloc) {
+        int nAlloc = d->nAlloc? d->nAlloc * 2 : 64;
+        
+        if (static_cast<sqlite3_int64>(nAlloc) * d->nPage > SQLITE_PSP2VFS_DIRTYSZ) {
+            nAlloc = SQLITE_PSP2VFS_DIRTYSZ / d->nPage;
+        }
+        
+        if (psp2DirtyGrow(d, nAlloc) != SQLITE_OK) {
+            rc = psp2FlushDirty(p);
+            return (rc == SQLITE_OK)? psp2DirectWrite(p, zBuf, iAmt, iOfst) : rc;
+        }
+    }
+    
+    i = d->nEntry++;
+    d->aOfst[i] = iOfst;
+    sceClibMemcpy(&d->aData[static_cast<sqlite3_int64>(i) * d->nPage], zBuf, iAmt);
+    
+    int iBucket = psp2DirtyBucket(d, iOfst);
+    d->aChain[i] = d->aBucket[iBucket];
+    d->aBucket[iBucket] = i;
+    
+    if (iOfst + iAmt > d->iEnd) {
+        d->iEnd = iOfst + iAmt;
+    }
+    
+    d->nHeld++;
+    return SQLITE_OK;
+}
+
+/*
+** Forget held pages at or past size. If a held page straddles it everything
+** is written out instead, the truncate then cuts that page short.
+*/
+static int psp2DirtyTruncate(PSP2File *p, sqlite3_int64 size) {
+    PSP2Dirty *d = p->pDirty;
+    int nKeep = 0;
+    
+    if (!d || d->nEntry == 0) {
+        return SQLITE_OK;
+    }
+    
+    d->iEnd = 0;
+    for (int i = 0; i < d->nEntry; i++) {
+        if (d->aOfst[i] >= size) {
+            continue;
+        }
+        
+        if (i != nKeep) {
+            d->aOfst[nKeep] = d->aOfst[i];
+            sceClibMemcpy(&d->aData[static_cast<sqlite3_int64>(nKeep) * d->nPage], &d->aData[static_cast<sqlite3_int64>(i) * d->nPage], d->nPage);
+        }
+        
+        if (d->aOfst[nKeep] + d->nPage > d->iEnd) {
+            d->iEnd = d->aOfst[nKeep] + d->nPage;
+        }
+        
+        nKeep++;
+    }
+    
+    d->nEntry = nKeep;
+    
+    sceClibMemset(d->aBucket, 0xFF, d->nHash * sizeof(int));
+    for (int i = 0; i < d->nEntry; i++) {
+        int iBucket = psp2DirtyBucket(d, d->aOfst[i]);
+        d->aChain[i] = d->aBucket[iBucket];
+        d->aBucket[iBucket] = i;
+    }
+    
+    return (d->iEnd > size)? psp2FlushDirty(p) : SQLITE_OK;
+}
+
+static void psp2DirtyClose(PSP2Dirty *d) {
+    if (d) {
+        sqlite3_free(d->aOfst);
+        sqlite3_free(d->aData);
+        sqlite3_free(d->aChain);
+        sqlite3_free(d);
+    }
+}
+
 /*
 ** Close a file.
 */
@@ -80,18 +582,106 @@ static int psp2Close(sqlite3_file *pFile) {
     int rc = 0;
     PSP2File *p = reinterpret_cast<PSP2File*>(pFile);
     rc = psp2FlushBuffer(p);
+    
+    if (rc == SQLITE_OK) {
+        rc = psp2FlushDirty(p);
+    }
+    
+    if (p->pCache && (p->pCache->nHit || p->pCache->nMiss)) {
+        Log::Info("psp2 VFS %s: %u cache hits, %u misses, %u reads bypassed\n", p->zName, p->pCache->nHit, p->pCache->nMiss, p->pCache->nBypass);
+    }
+    
+    if (p->pDirty && p->pDirty->nHeld) {
+        Log::Info("psp2 VFS %s: %u page writes held, written out in %u writes\n", p->zName, p->pDirty->nHeld, p->pDirty->nFlush);
+    }
+    
+    psp2DirtyClose(p->pDirty);
+    sqlite3_free(p->pCache);
     sqlite3_free(p->aBuffer);
     sceIoClose(p->fd);
     return rc;
 }
 
+/*
+** Read directly from the file, bypassing the read cache.
+*/
+static int psp2DirectRead(PSP2File *p, void *zBuf, int iAmt, sqlite_int64 iOfst) {
+    int nRead = 0;                      /* Return value from sceIoPread() */
+    
+    nRead = sceIoPread(p->fd, zBuf, iAmt, iOfst);
+    
+    if (nRead == iAmt) {
+        return SQLITE_OK;
+    }
+    else if (nRead >= 0) {
+        if (nRead < iAmt) {
+            sceClibMemset(&(static_cast<char*>(zBuf))[nRead], 0, iAmt-nRead);
+        }
+        
+        return SQLITE_IOERR_SHORT_READ;
+    }
+    
+    return SQLITE_IOERR_READ;
+}
+
+/*
+** Read through the cache one block at a time. A block that cannot be read
+** whole (the end of the file) is not cached, the rest of the read then goes
+** straight to the file.
+*/
+static int psp2CachedRead(PSP2File *p, void *zBuf, int iAmt, sqlite_int64 iOfst) {
+    PSP2Cache *c = p->pCache;
+    char *z = static_cast<char*>(zBuf);
+    unsigned int iGen = psp2WriteGen.load();
+    
+    if (c->iGen != iGen) {
+        psp2CacheReset(c);
+        c->iGen = iGen;
+    }
+    
+    while (iAmt > 0) {
+        sqlite3_int64 iBlock = iOfst - iOfst % SQLITE_PSP2VFS_CACHE_BLOCKSZ;
+        int iStart = static_cast<int>(iOfst - iBlock);
+        int n = SQLITE_PSP2VFS_CACHE_BLOCKSZ - iStart;
+        int i = psp2CacheFind(c, iBlock);
+        
+        if (n > iAmt) {
+            n = iAmt;
+        }
+        
+        if (i >= 0) {
+            c->nHit++;
+            psp2CacheTouch(c, i);
+        }
+        else {
+            i = psp2CacheEvict(c);
+            
+            if (sceIoPread(p->fd, &c->aData[static_cast<sqlite3_int64>(i) * SQLITE_PSP2VFS_CACHE_BLOCKSZ], SQLITE_PSP2VFS_CACHE_BLOCKSZ, iBlock) != SQLITE_PSP2VFS_CACHE_BLOCKSZ) {
+                c->nBypass++;
+                return psp2DirectRead(p, z, iAmt, iOfst);
+            }
+            
+            /* The file still has the old contents of any held page in the block. */
+            psp2DirtyOverlay(p->pDirty, &c->aData[static_cast<sqlite3_int64>(i) * SQLITE_PSP2VFS_CACHE_BLOCKSZ], iBlock, SQLITE_PSP2VFS_CACHE_BLOCKSZ);
+            
+            c->nMiss++;
+            psp2CacheInsert(c, i, iBlock);
+        }
+        
+        sceClibMemcpy(z, &c->aData[static_cast<sqlite3_int64>(i) * SQLITE_PSP2VFS_CACHE_BLOCKSZ + iStart], n);
+        z += n;
+        iOfst += n;
+        iAmt -= n;
+    }
+    
+    return SQLITE_OK;
+}
+
 /*
 ** Read data from a file.
 */
 static int psp2Read(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfst) {
     PSP2File *p = reinterpret_cast<PSP2File*>(pFile);
-    off_t ofst = 0;                     /* Return value from sceIoLseek() */
-    int nRead = 0;                      /* Return value from sceIoRead() */
     int rc = 0;                         /* Return code from psp2FlushBuffer() */
     
     /* Flush any data in the write buffer to disk in case this operation
@@ -105,25 +695,28 @@ static int psp2Read(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfs
         return rc;
     }
     
-    ofst = sceIoLseek(p->fd, iOfst, SCE_SEEK_SET);
-    if (ofst != iOfst) {
-        return SQLITE_IOERR_READ;
+    /* SQLite keeps the pages it wrote in its own cache, so reading a held
+    ** page back is rare enough to just write everything out first.
+    */
+    if (p->pDirty && psp2DirtyOverlaps(p->pDirty, iOfst, iAmt)) {
+        rc = psp2FlushDirty(p);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
     }
-        
-    nRead = sceIoRead(p->fd, zBuf, iAmt);
     
-    if (nRead == iAmt) {
-        return SQLITE_OK;
-    }
-    else if (nRead >= 0) {
-        if (nRead < iAmt) {
-            sceClibMemset(&(static_cast<char*>(zBuf))[nRead], 0, iAmt-nRead);
+    /* Reads larger than a block (pages bigger than the block size) would take
+    ** several reads through the cache instead of one.
+    */
+    if (p->pCache) {
+        if (iAmt <= SQLITE_PSP2VFS_CACHE_BLOCKSZ) {
+            return psp2CachedRead(p, zBuf, iAmt, iOfst);
         }
         
-        return SQLITE_IOERR_SHORT_READ;
+        p->pCache->nBypass++;
     }
     
-    return SQLITE_IOERR_READ;
+    return psp2DirectRead(p, zBuf, iAmt, iOfst);
 }
 
 /*
@@ -168,6 +761,32 @@ static int psp2Write(sqlite3_file *pFile, const void *zBuf, int iAmt, sqlite_int
             z += nCopy;
         }
     }
+    else if (p->pCache || p->pDirty) {
+        PSP2Cache *c = p->pCache;
+        int rc = SQLITE_OK;
+        
+        if (c && c->iGen != psp2WriteGen.load()) {
+            psp2CacheReset(c);
+        }
+        
+        if (c) {
+            psp2CacheWrite(c, zBuf, iAmt, iOfst);
+        }
+        
+        rc = p->pDirty? psp2DirtyWrite(p, zBuf, iAmt, iOfst) : psp2DirectWrite(p, zBuf, iAmt, iOfst);
+        
+        /* A failed write may have left anything in that part of the file. */
+        if (c && rc != SQLITE_OK) {
+            psp2CacheReset(c);
+        }
+        
+        unsigned int iGen = ++psp2WriteGen;
+        if (c) {
+            c->iGen = iGen;
+        }
+        
+        return rc;
+    }
     else {
         return psp2DirectWrite(p, zBuf, iAmt, iOfst);
     }
@@ -176,13 +795,60 @@ static int psp2Write(sqlite3_file *pFile, const void *zBuf, int iAmt, sqlite_int
 }
 
 /*
-** Truncate a file. This is a no-op for this VFS (see header comments at
-** the top of the file).
+** Set the size of a file with sceIoChstatByFd(). Used both to truncate and,
+** for SQLITE_FCNTL_SIZE_HINT, to extend. Failures are logged, so the log
+** shows whether a partition cannot change file sizes this way.
 */
-static int psp2Truncate(sqlite3_file *pFile, sqlite_int64 size) {
+static int psp2SetSize(PSP2File *p, sqlite3_int64 size) {
+    SceIoStat sStat = {0};
+    int ret = 0;
+    
+    sStat.st_size = size;
+    if ((ret = sceIoChstatByFd(p->fd, &sStat, SCE_CST_SIZE)) < 0) {
+        Log::Error("psp2 VFS %s: sceIoChstatByFd(SCE_CST_SIZE, %lld) failed: 0x%lx\n", p->zName, size, ret);
+        return SQLITE_IOERR_TRUNCATE;
+    }
+    
     return SQLITE_OK;
 }
 
+/*
+** Truncate a file. A main database left longer than its pages is still
+** valid (page 1 records the database size), so if the size cannot be set
+** it stays as long as it was, which is all this VFS did before. A journal
+** has to be cut short, as a stale one would be played back.
+*/
+static int psp2Truncate(sqlite3_file *pFile, sqlite_int64 size) {
+    PSP2File *p = reinterpret_cast<PSP2File*>(pFile);
+    int rc = 0;
+    
+    rc = psp2FlushBuffer(p);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    
+    rc = psp2DirtyTruncate(p, size);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    
+    rc = psp2SetSize(p, size);
+    
+    if (rc != SQLITE_OK && !p->aBuffer) {
+        rc = SQLITE_OK;
+    }
+    
+    /* Cached blocks past the new end would otherwise still be returned if the
+    ** file grows again.
+    */
+    if (p->pCache) {
+        psp2CacheReset(p->pCache);
+        p->pCache->iGen = ++psp2WriteGen;
+    }
+    
+    return rc;
+}
+
 /*
 ** Sync the contents of the file to the persistent media.
 */
@@ -195,6 +861,11 @@ static int psp2Sync(sqlite3_file *pFile, int flags) {
         return rc;
     }
     
+    rc = psp2FlushDirty(p);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    
     rc = sceIoSyncByFd(p->fd, 0);
     return (rc == 0? SQLITE_OK : SQLITE_IOERR_FSYNC);
 }
@@ -224,6 +895,12 @@ static int psp2FileSize(sqlite3_file *pFile, sqlite_int64 *pSize) {
     }
         
     *pSize = sStat.st_size;
+    
+    /* Held pages past the end of the file already count towards its size. */
+    if (p->pDirty && p->pDirty->nEntry && p->pDirty->iEnd > *pSize) {
+        *pSize = p->pDirty->iEnd;
+    }
+    
     return SQLITE_OK;
 }
 
@@ -237,8 +914,12 @@ static int psp2Lock(sqlite3_file *pFile, int eLock) {
     return SQLITE_OK;
 }
 
+/*
+** Held pages are written out before the lock is given up, so they are never
+** left behind when a transaction ends without a sync (PRAGMA synchronous=OFF).
+*/
 static int psp2Unlock(sqlite3_file *pFile, int eLock) {
-    return SQLITE_OK;
+    return psp2FlushDirty(reinterpret_cast<PSP2File*>(pFile));
 }
 
 static int psp2CheckReservedLock(sqlite3_file *pFile, int *pResOut) {
@@ -247,9 +928,30 @@ static int psp2CheckReservedLock(sqlite3_file *pFile, int *pResOut) {
 }
 
 /*
-** No xFileControl() verbs are implemented by this VFS.
+** SQLITE_FCNTL_SIZE_HINT is sent before the pages of a transaction are
+** written, so a file that grows is extended once instead of a page at a
+** time. It is only a hint, so a file that cannot be extended is left to
+** grow with the writes.
 */
 static int psp2FileControl(sqlite3_file *pFile, int op, void *pArg) {
+    PSP2File *p = reinterpret_cast<PSP2File*>(pFile);
+    
+    switch (op) {
+        case SQLITE_FCNTL_SIZE_HINT: {
+            sqlite3_int64 size = *static_cast<sqlite3_int64*>(pArg);
+            SceIoStat sStat = {0};
+            
+            if (sceIoGetstatByFd(p->fd, &sStat) == 0 && size > sStat.st_size) {
+                psp2SetSize(p, size);
+            }
+            
+            return SQLITE_OK;
+        }
+        
+        default:
+            break;
+    }
+    
     return SQLITE_NOTFOUND;
 }
 
@@ -322,6 +1024,7 @@ static int psp2Open(sqlite3_vfs *pVfs, const char *zName, sqlite3_file *pFile, i
     }
     
     sceClibMemset(p, 0, sizeof(PSP2File));
+    
     p->fd = sceIoOpen(zName, oflags, 7);
     
     if (p->fd < 0) {
@@ -330,6 +1033,19 @@ static int psp2Open(sqlite3_vfs *pVfs, const char *zName, sqlite3_file *pFile, i
     }
     
     p->aBuffer = aBuf;
+    p->zName = zName;
+    
+    if (flags & SQLITE_OPEN_MAIN_DB) {
+        p->pCache = psp2CacheOpen();
+        
+        if (SQLITE_PSP2VFS_DIRTYSZ > 0 && (flags & SQLITE_OPEN_READWRITE)) {
+            p->pDirty = reinterpret_cast<PSP2Dirty*>(sqlite3_malloc(sizeof(PSP2Dirty)));
+            
+            if (p->pDirty) {
+                sceClibMemset(p->pDirty, 0, sizeof(PSP2Dirty));
+            }
+        }
+    }
     
     if (pOutFlags) {
         *pOutFlags = flags;
@@ -373,39 +1089,26 @@ static int psp2Delete(sqlite3_vfs *pVfs, const char *zPath, int dirSync) {
     //     }
     // }
     rc = sceIoRemove(zPath);
-    return (rc < 0? SQLITE_IOERR_DELETE : SQLITE_OK);
+    
+    /* SQLite deletes journal files that may already be gone. */
+    if (rc < 0) {
+        SceIoStat sStat = {0};
+        return (sceIoGetstat(zPath, &sStat) < 0)? SQLITE_IOERR_DELETE_NOENT : SQLITE_IOERR_DELETE;
+    }
+    
+    return SQLITE_OK;
 }
 
-// #ifndef F_OK
-// # define F_OK 0
-// #endif
-// #ifndef R_OK
-// # define R_OK 4
-// #endif
-// #ifndef W_OK
-// # define W_OK 2
-// #endif
-
 /*
-** Query the file-system to see if the named file exists, is readable or
-** is both readable and writable.
+** Query the file-system to see if the named file exists. Files on the
+** memory card are always readable and writable, so SQLITE_ACCESS_READ and
+** SQLITE_ACCESS_READWRITE are answered the same way. SQLite relies on this
+** to tell whether a hot journal is present.
 */
 static int psp2Access(sqlite3_vfs *pVfs, const char *zPath, int flags, int *pResOut) {
-    int rc = 0;                     /* access() return code */
-    // int eAccess = F_OK;             /* Second argument to access() */
+    SceIoStat sStat = {0};
     
-    // assert(flags == SQLITE_ACCESS_EXISTS       /* access(zPath, F_OK) */
-    //     || flags == SQLITE_ACCESS_READ         /* access(zPath, R_OK) */
-    //     || flags == SQLITE_ACCESS_READWRITE    /* access(zPath, R_OK|W_OK) */
-    // );
-    
-    // if (flags == SQLITE_ACCESS_READWRITE)
-    //     eAccess = R_OK|W_OK;
-    // if (flags == SQLITE_ACCESS_READ)
-    //     eAccess = R_OK;
-        
-    // rc = access(zPath, eAccess);
-    *pResOut = (rc == 0);
+    *pResOut = (sceIoGetstat(zPath, &sStat) >= 0);
     return SQLITE_OK;
 }
 
@@ -0,0 +1,750 @@
+#include <algorithm>
+#include <psp2/io/dirent.h>
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "fs.h"
+#include "log.h"
+#include "store.h"
+#include "utils.h"
+
+namespace Store {
+    constexpr char store_path[] = "ux0:data/VITAHomebrewSorter/store";
+    constexpr char pack_path[] = "ux0:data/VITAHomebrewSorter/store/blocks.pack";
+    constexpr char index_path[] = "ux0:data/VITAHomebrewSorter/store/blocks.idx";
+    constexpr const char *manifest_dirs[] = { "ux0:data/VITAHomebrewSorter/backup", "ux0:data/VITAHomebrewSorter/loadouts" };
+
+    constexpr uint32_t PACK_MAGIC = 0x50534856;     // "VHSP"
+    constexpr uint32_t INDEX_MAGIC = 0x49534856;    // "VHSI"
+    constexpr uint32_t MANIFEST_MAGIC = 0x4D534856; // "VHSM"
+    constexpr uint32_t STORE_VERSION = 1;
+    constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+    constexpr uint32_t MAX_BLOCK_SIZE = 65536;
+    constexpr SceSize COPY_SIZE = 1024 * 1024;
+
+    // The pack is a header followed by records, each a RecordHeader and the block it describes. Records are never
+    // changed once written, a new pack with a new generation replaces the old one when garbage is collected.
+    struct PackHeader {
+        uint32_t magic = PACK_MAGIC;
+        uint32_t version = STORE_VERSION;
+        uint32_t generation = 0;
+        uint32_t reserved = 0;
+    };
+
+    struct RecordHeader {
+        uint64_t hash = 0;
+        uint32_t size = 0;
+        uint32_t reserved = 0;
+    };
+
+    // The index only caches where each block is in the pack. Records past packSize, or all of them if the
+    // generation does not match, are found again by scanning the pack.
+    struct IndexHeader {
+        uint32_t magic = INDEX_MAGIC;
+        uint32_t version = STORE_VERSION;
+        uint32_t generation = 0;
+        uint32_t count = 0;
+        SceOff packSize = 0;
+        uint64_t checksum = 0; // Hash of the entries after the header.
+    };
+
+    struct IndexEntry {
+        uint64_t hash = 0;
+        SceOff offset = 0;
+        uint32_t size = 0;
+        uint32_t reserved = 0;
+    };
+
+    struct ManifestHeader {
+        uint32_t magic = MANIFEST_MAGIC;
+        uint32_t version = STORE_VERSION;
+        uint32_t count = 0;    // Files in the manifest.
+        uint32_t size = 0;     // Bytes after the header.
+        uint64_t checksum = 0; // Hash of the bytes after the header.
+    };
+
+    struct Location {
+        SceOff offset = 0; // Of the block data, right after its RecordHeader.
+        uint32_t size = 0;
+    };
+
+    struct Index {
+        uint32_t generation = 0;
+        SceOff packSize = 0;
+        bool dirty = false;
+        std::unordered_map<uint64_t, Location> blocks;
+    };
+
+    struct ManifestFile {
+        std::string path;
+        SceOff size = 0;
+        uint32_t blockSize = 0;
+        std::vector<uint64_t> blocks;
+    };
+
+    static inline uint64_t Rotl(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    template<typename T>
+    static inline T Load(const unsigned char *data) {
+        T value;
+        sceClibMemcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    // XXH64 with a seed of 0. Only used to tell blocks apart, a collision would make a snapshot refer to the wrong
+    // block, which at 64 bits is not a concern for the few thousand blocks a store holds.
+    static uint64_t Hash(const unsigned char *data, SceSize size) {
+        constexpr uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL,
+            P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+
+        auto round = [&](uint64_t acc, uint64_t input) {
+            return Store::Rotl(acc + input * P2, 31) * P1;
+        };
+
+        const unsigned char *end = data + size;
+        uint64_t hash = 0;
+
+        if (size >= 32) {
+            uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+            for (; data + 32 <= end; data += 32) {
+                v1 = round(v1, Store::Load<uint64_t>(data));
+                v2 = round(v2, Store::Load<uint64_t>(data + 8));
+                v3 = round(v3, Store::Load<uint64_t>(data + 16));
+                v4 = round(v4, Store::Load<uint64_t>(data + 24));
+            }
+
+            hash = Store::Rotl(v1, 1) + Store::Rotl(v2, 7) + Store::Rotl(v3, 12) + Store::Rotl(v4, 18);
+            hash = (hash ^ round(0, v1)) * P1 + P4;
+            hash = (hash ^ round(0, v2)) * P1 + P4;
+            hash = (hash ^ round(0, v3)) * P1 + P4;
+            hash = (hash ^ round(0, v4)) * P1 + P4;
+        }
+        else {
+            hash = P5;
+        }
+
+        hash += size;
+
+        for (; data + 8 <= end; data += 8) {
+            hash = Store::Rotl(hash ^ round(0, Store::Load<uint64_t>(data)), 27) * P1 + P4;
+        }
+
+        if (data + 4 <= end) {
+            hash = Store::Rotl(hash ^ (Store::Load<uint32_t>(data) * P1), 23) * P2 + P3;
+            data += 4;
+        }
+
+        for (; data < end; data++) {
+            hash = Store::Rotl(hash ^ (*data * P5), 11) * P1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= P2;
+        hash ^= hash >> 29;
+        hash *= P3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    // SQLite databases are split on their page size, so a page that did not change between snapshots is only
+    // stored once. Anything else is split into fixed size blocks.
+    static uint32_t BlockSize(const unsigned char *data, SceOff size) {
+        if ((size >= 100) && (sceClibMemcmp(data, "SQLite format 3", 16) == 0)) {
+            const uint32_t page_size = (data[16] << 8) | data[17];
+
+            if (page_size == 1) {
+                return MAX_BLOCK_SIZE;
+            }
+            else if ((page_size >= 512) && ((page_size & (page_size - 1)) == 0)) {
+                return page_size;
+            }
+        }
+
+        return DEFAULT_BLOCK_SIZE;
+    }
+
+    static std::string FileName(const std::string &path) {
+        const size_t slash = path.find_last_of('/');
+        return (slash == std::string::npos)? path : path.substr(slash + 1);
+    }
+
+    bool IsManifest(const std::string &path) {
+        return !FS::GetFileExt(path).compare(".MANIFEST");
+    }
+
+    // Writes data to path.tmp and only then replaces path, so a failed write never leaves a truncated file behind.
+    static int Replace(const std::string &path, const void *data, SceSize size) {
+        int ret = 0;
+        const std::string temp_path = path + ".tmp";
+
+        if ((ret = FS::WriteFile(temp_path, data, size)) != static_cast<int>(size)) {
+            FS::RemoveFile(temp_path);
+            return R_FAILED(ret)? ret : -1;
+        }
+
+        return FS::ReplaceFile(temp_path, path);
+    }
+
+    static void ReadIndex(Index &index) {
+        SceOff size = 0;
+        IndexHeader header;
+
+        FS::RecoverFile(index_path);
+        if (!FS::FileExists(index_path) || R_FAILED(FS::GetFileSize(index_path, size)) || (size < static_cast<SceOff>(sizeof(IndexHeader)))) {
+            return;
+        }
+
+        std::vector<unsigned char> data(size);
+        if (FS::ReadFile(index_path, data.data(), size) != size) {
+            return;
+        }
+
+        sceClibMemcpy(&header, data.data(), sizeof(IndexHeader));
+        const unsigned char *entries = data.data() + sizeof(IndexHeader);
+        const SceSize entries_size = size - sizeof(IndexHeader);
+
+        if ((header.magic != INDEX_MAGIC) || (header.version != STORE_VERSION) || (entries_size != header.count * sizeof(IndexEntry)) ||
+            (header.checksum != Store::Hash(entries, entries_size))) {
+            return;
+        }
+
+        index.generation = header.generation;
+        index.packSize = header.packSize;
+        index.blocks.reserve(header.count);
+
+        for (uint32_t i = 0; i < header.count; i++) {
+            const IndexEntry entry = Store::Load<IndexEntry>(entries + i * sizeof(IndexEntry));
+            index.blocks[entry.hash] = { entry.offset, entry.size };
+        }
+    }
+
+    static int WriteIndex(const Index &index) {
+        std::vector<unsigned char> data(sizeof(IndexHeader) + index.blocks.size() * sizeof(IndexEntry));
+        IndexHeader header;
+        header.generation = index.generation;
+        header.count = index.blocks.size();
+        header.packSize = index.packSize;
+
+        unsigned char *cursor = data.data() + sizeof(IndexHeader);
+        for (const auto &block : index.blocks) {
+            IndexEntry entry;
+            entry.hash = block.first;
+            entry.offset = block.second.offset;
+            entry.size = block.second.size;
+            sceClibMemcpy(cursor, &entry, sizeof(IndexEntry));
+            cursor += sizeof(IndexEntry);
+        }
+
+        header.checksum = Store::Hash(data.data() + sizeof(IndexHeader), data.size() - sizeof(IndexHeader));
+        sceClibMemcpy(data.data(), &header, sizeof(IndexHeader));
+        return Store::Replace(index_path, data.data(), data.size());
+    }
+
+    // Adds the records between index.packSize and end to the index. Scanning stops at the first record that is cut
+    // short or does not match its hash, which is where an interrupted append left off.
+    static void Scan(SceUID pack, Index &index, SceOff end) {
+        std::vector<unsigned char> block(MAX_BLOCK_SIZE);
+        SceOff offset = index.packSize;
+        RecordHeader record;
+
+        while (offset + static_cast<SceOff>(sizeof(RecordHeader)) <= end) {
+            if ((sceIoPread(pack, &record, sizeof(RecordHeader), offset) != sizeof(RecordHeader)) || (record.size == 0) ||
+                (record.size > MAX_BLOCK_SIZE) || (offset + static_cast<SceOff>(sizeof(RecordHeader) + record.size) > end)) {
+                break;
+            }
+
+            if ((sceIoPread(pack, block.data(), record.size, offset + sizeof(RecordHeader)) != static_cast<int>(record.size)) ||
+                (Store::Hash(block.data(), record.size) != record.hash)) {
+                break;
+            }
+
+            index.blocks[record.hash] = { offset + static_cast<SceOff>(sizeof(RecordHeader)), record.size };
+            offset += sizeof(RecordHeader) + record.size;
+            index.dirty = true;
+        }
+
+        index.packSize = offset;
+    }
+
+    // Opens the pack and loads its index, creating an empty pack first when writing to a store that has none.
+    static int OpenPack(Index &index, bool write, SceUID &pack) {
+        int ret = 0;
+        PackHeader header;
+
+        if (write && !FS::DirExists(store_path)) {
+            FS::MakeDir(store_path);
+        }
+
+        FS::RecoverFile(pack_path);
+
+        if (R_FAILED(ret = pack = sceIoOpen(pack_path, write? (SCE_O_RDWR | SCE_O_CREAT) : SCE_O_RDONLY, 0777))) {
+            Log::Error("sceIoOpen(%s) failed: 0x%lx\n", pack_path, ret);
+            return ret;
+        }
+
+        SceOff size = sceIoLseek(pack, 0, SCE_SEEK_END);
+
+        if (write && (size == 0)) {
+            if (FS::FileExists(index_path)) {
+                FS::RemoveFile(index_path);
+            }
+
+            header.generation = 1;
+            if ((ret = sceIoPwrite(pack, &header, sizeof(PackHeader), 0)) != sizeof(PackHeader)) {
+                Log::Error("sceIoPwrite(%s) failed: 0x%lx\n", pack_path, ret);
+                sceIoClose(pack);
+                return R_FAILED(ret)? ret : -1;
+            }
+
+            size = sizeof(PackHeader);
+        }
+        else if ((size < static_cast<SceOff>(sizeof(PackHeader))) || (sceIoPread(pack, &header, sizeof(PackHeader), 0) != sizeof(PackHeader)) ||
+            (header.magic != PACK_MAGIC) || (header.version != STORE_VERSION)) {
+            Log::Error("%s is not a valid pack\n", pack_path);
+            sceIoClose(pack);
+            return -1;
+        }
+
+        Store::ReadIndex(index);
+
+        if ((index.generation != header.generation) || (index.packSize > size) || (index.packSize < static_cast<SceOff>(sizeof(PackHeader)))) {
+            index.blocks.clear();
+            index.generation = header.generation;
+            index.packSize = sizeof(PackHeader);
+            index.dirty = true;
+        }
+
+        if (index.packSize < size) {
+            Store::Scan(pack, index, size);
+        }
+
+        return 0;
+    }
+
+    static bool ReadManifest(const std::string &manifest_path, std::vector<ManifestFile> &files) {
+        SceOff size = 0;
+        ManifestHeader header;
+
+        if (R_FAILED(FS::GetFileSize(manifest_path, size)) || (size < static_cast<SceOff>(sizeof(ManifestHeader)))) {
+            return false;
+        }
+
+        std::vector<unsigned char> data(size);
+        if (FS::ReadFile(manifest_path, data.data(), size) != size) {
+            return false;
+        }
+
+        sceClibMemcpy(&header, data.data(), sizeof(ManifestHeader));
+        const unsigned char *cursor = data.data() + sizeof(ManifestHeader);
+        const unsigned char *end = data.data() + data.size();
+
+        if ((header.magic != MANIFEST_MAGIC) || (header.version != STORE_VERSION) || (header.size != static_cast<uint32_t>(end - cursor)) ||
+            (header.checksum != Store::Hash(cursor, header.size))) {
+            Log::Error("%s is not a valid manifest\n", manifest_path.c_str());
+            return false;
+        }
+
+        files.resize(header.count);
+
+        for (ManifestFile &file : files) {
+            const SceSize fixed = sizeof(uint32_t) + sizeof(uint32_t) + sizeof(SceOff) + sizeof(uint32_t);
+            if (static_cast<SceSize>(end - cursor) < fixed) {
+                return false;
+            }
+
+            const uint32_t path_len = Store::Load<uint32_t>(cursor);
+            file.blockSize = Store::Load<uint32_t>(cursor + 4);
+            file.size = Store::Load<SceOff>(cursor + 8);
+            const uint32_t count = Store::Load<uint32_t>(cursor + 16);
+            cursor += fixed;
+
+            if ((static_cast<SceSize>(end - cursor) < path_len) || ((end - cursor - path_len) / sizeof(uint64_t) < count)) {
+                return false;
+            }
+
+            file.path.assign(reinterpret_cast<const char *>(cursor), path_len);
+            cursor += path_len;
+
+            file.blocks.resize(count);
+            sceClibMemcpy(file.blocks.data(), cursor, count * sizeof(uint64_t));
+            cursor += count * sizeof(uint64_t);
+        }
+
+        return (cursor == end);
+    }
+
+    static int WriteManifest(const std::string &manifest_path, const std::vector<ManifestFile> &files) {
+        std::vector<unsigned char> data(sizeof(ManifestHeader));
+
+        auto put = [&data](const void *value, SceSize size) {
+            const unsigned char *bytes = static_cast<const unsigned char *>(value);
+            data.insert(data.end(), bytes, bytes + size);
+        };
+
+        for (const ManifestFile &file : files) {
+            const uint32_t path_len = file.path.size();
+            const uint32_t count = file.blocks.size();
+            put(&path_len, sizeof(path_len));
+            put(&file.blockSize, sizeof(file.blockSize));
+            put(&file.size, sizeof(file.size));
+            put(&count, sizeof(count));
+            put(file.path.data(), path_len);
+            put(file.blocks.data(), count * sizeof(uint64_t));
+        }
+
+        ManifestHeader header;
+        header.count = files.size();
+        header.size = data.size() - sizeof(ManifestHeader);
+        header.checksum = Store::Hash(data.data() + sizeof(ManifestHeader), header.size);
+        sceClibMemcpy(data.data(), &header, sizeof(ManifestHeader));
+        return Store::Replace(manifest_path, data.data(), data.size());
+    }
+
+    // Reads the blocks of file back in order. Blocks that were appended together sit next to each other in the
+    // pack, so runs of them are read with one call and checked against their hashes as they are copied out.
+    static int ReadBlocks(SceUID pack, const Index &index, const ManifestFile &file, std::vector<unsigned char> &data) {
+        std::vector<unsigned char> run;
+        data.resize(file.size);
+        SceOff copied = 0;
+        size_t i = 0;
+
+        while (i < file.blocks.size()) {
+            auto first = index.blocks.find(file.blocks[i]);
+            if (first == index.blocks.end()) {
+                Log::Error("Store block %016llx of %s is missing\n", file.blocks[i], file.path.c_str());
+                return -1;
+            }
+
+            SceOff run_end = first->second.offset + first->second.size;
+            size_t j = i + 1;
+
+            for (; j < file.blocks.size(); j++) {
+                auto next = index.blocks.find(file.blocks[j]);
+                if ((next == index.blocks.end()) || (next->second.offset != run_end + static_cast<SceOff>(sizeof(RecordHeader))) ||
+                    (run_end - first->second.offset >= static_cast<SceOff>(COPY_SIZE))) {
+                    break;
+                }
+
+                run_end = next->second.offset + next->second.size;
+            }
+
+            const SceSize run_size = run_end - first->second.offset;
+            run.resize(run_size);
+
+            if (sceIoPread(pack, run.data(), run_size, first->second.offset) != static_cast<int>(run_size)) {
+                Log::Error("sceIoPread(%s) failed\n", pack_path);
+                return -1;
+            }
+
+            SceOff offset = 0;
+            for (; i < j; i++) {
+                const uint32_t size = index.blocks.at(file.blocks[i]).size;
+
+                if ((copied + size > file.size) || (Store::Hash(run.data() + offset, size) != file.blocks[i])) {
+                    Log::Error("Store block %016llx of %s is corrupt\n", file.blocks[i], file.path.c_str());
+                    return -1;
+                }
+
+                sceClibMemcpy(data.data() + copied, run.data() + offset, size);
+                copied += size;
+                offset += size + sizeof(RecordHeader);
+            }
+        }
+
+        return (copied == file.size)? 0 : -1;
+    }
+
+    static void ListManifests(const std::string &dir, std::vector<std::string> &paths) {
+        SceUID handle = 0;
+
+        if (R_FAILED(handle = sceIoDopen(dir.c_str()))) {
+            return;
+        }
+
+        SceIoDirent entry;
+        sceClibMemset(&entry, 0, sizeof(entry));
+
+        while (sceIoDread(handle, &entry) > 0) {
+            if (!SCE_S_ISDIR(entry.d_stat.st_mode) && Store::IsManifest(entry.d_name)) {
+                paths.push_back(dir + "/" + entry.d_name);
+            }
+
+            sceClibMemset(&entry, 0, sizeof(entry));
+        }
+
+        sceIoDclose(handle);
+    }
+
+    // Drops the blocks no manifest refers to any more. The pack is only rewritten once at least half of it is
+    // garbage, so a backup that replaces the previous one does not copy the whole pack every time.
+    static int Collect(void) {
+        int ret = 0;
+        std::vector<std::string> manifests;
+        std::unordered_set<uint64_t> live;
+
+        for (const char *dir : manifest_dirs) {
+            Store::ListManifests(dir, manifests);
+        }
+
+        for (const std::string &manifest : manifests) {
+            std::vector<ManifestFile> files;
+
+            // Without every manifest there is no telling which blocks are still needed.
+            if (!Store::ReadManifest(manifest, files)) {
+                return -1;
+            }
+
+            for (const ManifestFile &file : files) {
+                live.insert(file.blocks.begin(), file.blocks.end());
+            }
+        }
+
+        if (!FS::FileExists(pack_path)) {
+            return 0;
+        }
+
+        Index index;
+        SceUID pack = 0;
+
+        if (R_FAILED(ret = Store::OpenPack(index, false, pack))) {
+            return ret;
+        }
+
+        std::vector<std::pair<uint64_t, Location>> blocks;
+        SceOff live_size = sizeof(PackHeader);
+
+        for (const auto &block : index.blocks) {
+            if (live.count(block.first) != 0) {
+                blocks.push_back(block);
+                live_size += sizeof(RecordHeader) + block.second.size;
+            }
+        }
+
+        if ((index.packSize - live_size) * 2 < index.packSize) {
+            sceIoClose(pack);
+            return index.dirty? Store::WriteIndex(index) : 0;
+        }
+
+        // Live blocks keep their relative order, so blocks of one snapshot stay next to each other.
+        std::sort(blocks.begin(), blocks.end(), [](const std::pair<uint64_t, Location> &a, const std::pair<uint64_t, Location> &b) {
+            return a.second.offset < b.second.offset;
+        });
+
+        const std::string temp_path = std::string(pack_path) + ".tmp";
+        SceUID out = 0;
+
+        if (R_FAILED(ret = out = sceIoOpen(temp_path.c_str(), SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777))) {
+            Log::Error("sceIoOpen(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+            sceIoClose(pack);
+            return ret;
+        }
+
+        Index collected;
+        collected.generation = index.generation + 1;
+        collected.packSize = sizeof(PackHeader);
+
+        PackHeader header;
+        header.generation = collected.generation;
+
+        std::vector<unsigned char> buffer(reinterpret_cast<const unsigned char *>(&header), reinterpret_cast<const unsigned char *>(&header) + sizeof(PackHeader));
+        buffer.reserve(COPY_SIZE + sizeof(RecordHeader) + MAX_BLOCK_SIZE);
+
+        for (size_t i = 0; (i < blocks.size()) && R_SUCCEEDED(ret); i++) {
+            const Location &location = blocks[i].second;
+            const SceOff record = location.offset - sizeof(RecordHeader);
+            const SceSize record_size = sizeof(RecordHeader) + location.size;
+            const size_t used = buffer.size();
+
+            buffer.resize(used + record_size);
+            if (sceIoPread(pack, buffer.data() + used, record_size, record) != static_cast<int>(record_size)) {
+                Log::Error("sceIoPread(%s) failed\n", pack_path);
+                ret = -1;
+                break;
+            }
+
+            collected.blocks[blocks[i].first] = { collected.packSize + static_cast<SceOff>(sizeof(RecordHeader)), location.size };
+            collected.packSize += record_size;
+
+            if ((buffer.size() >= COPY_SIZE) || (i + 1 == blocks.size())) {
+                if ((ret = sceIoWrite(out, buffer.data(), buffer.size())) != static_cast<int>(buffer.size())) {
+                    Log::Error("sceIoWrite(%s) failed: 0x%lx\n", temp_path.c_str(), ret);
+                    ret = R_FAILED(ret)? ret : -1;
+                    break;
+                }
+
+                ret = 0;
+                buffer.clear();
+            }
+        }
+
+        // A pack with no live blocks left is just its header.
+        if (R_SUCCEEDED(ret) && blocks.empty() && (sceIoWrite(out, buffer.data(), buffer.size()) != static_cast<int>(buffer.size()))) {
+            ret = -1;
+        }
+
+        sceIoClose(pack);
+        sceIoClose(out);
+
+        if (R_FAILED(ret)) {
+            FS::RemoveFile(temp_path);
+            return ret;
+        }
+
+        // If this is interrupted before the index is written, the generation no longer matches and the index is
+        // rebuilt from the new pack.
+        if (R_FAILED(ret = FS::ReplaceFile(temp_path, pack_path))) {
+            return ret;
+        }
+
+        Log::Info("Store::Collect: %u of %u blocks kept, pack %lld -> %lld bytes\n", static_cast<uint32_t>(blocks.size()),
+            static_cast<uint32_t>(index.blocks.size()), index.packSize, collected.packSize);
+        return Store::WriteIndex(collected);
+    }
+
+    int Write(const std::string &manifest_path, const std::vector<File> &files) {
+        int ret = 0;
+        Index index;
+        SceUID pack = 0;
+        const SceUInt64 start = sceKernelGetProcessTimeWide();
+
+        if (R_FAILED(ret = Store::OpenPack(index, true, pack))) {
+            return ret;
+        }
+
+        std::vector<ManifestFile> manifest(files.size());
+        std::vector<unsigned char> pending; // New records, appended to the pack with one write.
+        uint32_t total = 0, added = 0;
+
+        for (size_t i = 0; i < files.size(); i++) {
+            const File &file = files[i];
+            ManifestFile &entry = manifest[i];
+            entry.path = file.path;
+            entry.size = file.size;
+            entry.blockSize = Store::BlockSize(file.data, file.size);
+            entry.blocks.reserve((file.size + entry.blockSize - 1) / entry.blockSize);
+
+            for (SceOff offset = 0; offset < file.size; offset += entry.blockSize) {
+                const uint32_t size = std::min<SceOff>(entry.blockSize, file.size - offset);
+                const unsigned char *block = file.data + offset;
+
+                RecordHeader record;
+                record.hash = Store::Hash(block, size);
+                record.size = size;
+                entry.blocks.push_back(record.hash);
+                total++;
+
+                if (index.blocks.count(record.hash) != 0) {
+                    continue;
+                }
+
+                index.blocks[record.hash] = { index.packSize + static_cast<SceOff>(pending.size() + sizeof(RecordHeader)), size };
+                pending.insert(pending.end(), reinterpret_cast<const unsigned char *>(&record), reinterpret_cast<const unsigned char *>(&record) + sizeof(RecordHeader));
+                pending.insert(pending.end(), block, block + size);
+                added++;
+            }
+        }
+
+        if (!pending.empty()) {
+            if ((ret = sceIoPwrite(pack, pending.data(), pending.size(), index.packSize)) != static_cast<int>(pending.size())) {
+                Log::Error("sceIoPwrite(%s) failed: 0x%lx\n", pack_path, ret);
+                sceIoClose(pack);
+                return R_FAILED(ret)? ret : -1;
+            }
+
+            index.packSize += pending.size();
+            index.dirty = true;
+        }
+
+        sceIoClose(pack);
+
+        // The pack is written before the index and the index before the manifest, so a manifest never refers to a
+        // block that is not in the pack.
+        if (index.dirty && R_FAILED(ret = Store::WriteIndex(index))) {
+            return ret;
+        }
+
+        if (R_FAILED(ret = Store::WriteManifest(manifest_path, manifest))) {
+            return ret;
+        }
+
+        Log::Info("Store::Write(%s): %u of %u blocks new, %u bytes appended in %llu us\n", Store::FileName(manifest_path).c_str(), added, total,
+            static_cast<uint32_t>(pending.size()), sceKernelGetProcessTimeWide() - start);
+
+        // Replacing a manifest can leave blocks behind, a failed collection only costs space.
+        Store::Collect();
+        return 0;
+    }
+
+    int Read(const std::string &manifest_path, const std::string &path, std::vector<unsigned char> &data) {
+        int ret = 0;
+        std::vector<ManifestFile> files;
+        Index index;
+        SceUID pack = 0;
+
+        if (!Store::ReadManifest(manifest_path, files)) {
+            return -1;
+        }
+
+        auto file = std::find_if(files.begin(), files.end(), [&path](const ManifestFile &file) {
+            return file.path == path;
+        });
+
+        if (file == files.end()) {
+            Log::Error("%s has no %s\n", manifest_path.c_str(), path.c_str());
+            return -1;
+        }
+
+        if (R_FAILED(ret = Store::OpenPack(index, false, pack))) {
+            return ret;
+        }
+
+        ret = Store::ReadBlocks(pack, index, *file, data);
+        sceIoClose(pack);
+        return ret;
+    }
+
+    int Restore(const std::string &manifest_path) {
+        int ret = 0;
+        std::vector<ManifestFile> files;
+        std::vector<unsigned char> data;
+        Index index;
+        SceUID pack = 0;
+
+        if (!Store::ReadManifest(manifest_path, files)) {
+            return -1;
+        }
+
+        if (R_FAILED(ret = Store::OpenPack(index, false, pack))) {
+            return ret;
+        }
+
+        for (const ManifestFile &file : files) {
+            if (R_FAILED(ret = Store::ReadBlocks(pack, index, file, data))) {
+                break;
+            }
+
+            if (R_FAILED(ret = Store::Replace(file.path, data.data(), data.size()))) {
+                break;
+            }
+        }
+
+        sceIoClose(pack);
+        return ret;
+    }
+
+    int Remove(const std::string &manifest_path) {
+        int ret = 0;
+
+        if (R_FAILED(ret = FS::RemoveFile(manifest_path))) {
+            return ret;
+        }
+
+        Store::Collect();
+        return 0;
+    }
+}
@@ -15,7 +15,7 @@ namespace Tabs {
             ImGui::Dummy(ImVec2(0.0f, 5.0f)); // Spacing
             
             if (ImGui::Button("Reset", ImVec2(ImGui::GetContentRegionAvail().x * 0.33f, 0.0f))) {
-                AppList::Get(entries);
+                AppList::Refresh(entries);
                 old_page_id = -1;
             }
 
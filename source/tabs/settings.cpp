@@ -55,7 +55,7 @@ namespace Tabs {
             std::string usage = std::string("VITA Homebrew Sorter is a basic PS VITA homebrew application that sorts the application database in your LiveArea.")
                 + " The application sorts apps and games that are inside folders as well. This applications also allows you to backup your current 'loadout' that "
                 + " you can switch into as you wish. A backup will be made before any changes are applied to the application database."
-                + " This backup is overwritten each time you use the sort option. You can find the backup in ux0:/data/VITAHomebrewSorter/backups/app.db."
+                + " This backup is overwritten each time you use the sort option. Backups and loadouts share one store in ux0:/data/VITAHomebrewSorter/store/, so only what changed between them takes up space."
                 + " \n\nIt is always recommended to restart your vita so that it can refresh your livearea/app.db for any changes (deleted icons, new folders, etc.)"
                 + " before you run this application.";
             ImGui::TextWrapped(usage.c_str());
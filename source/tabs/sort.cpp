@@ -10,6 +10,16 @@ namespace Tabs {
     static const ImVec2 tex_size = ImVec2(20, 20);
     static const char *sort_by[] = {"Title", "Title ID"};
     static const char *sort_folders[] = {"Both", "Apps only", "Folders only"};
+    static const char *sort_placement[] = {"Full", "Incremental"};
+
+    static void Place(AppEntries &entries) {
+        if (cfg.sort_placement == PlacementIncremental) {
+            AppList::Place(entries);
+        }
+        else {
+            AppList::Sort(entries);
+        }
+    }
 
     void Sort(AppEntries &entries, State &state, bool &backupExists) {
         ImGuiTableFlags tableFlags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersInner | ImGuiTableFlags_BordersOuter |
@@ -64,29 +74,50 @@ namespace Tabs {
             
             ImGui::SameLine();
             
+            ImGui::PushID("sort_placement");
+            ImGui::PushItemWidth(130.f);
+            if (ImGui::BeginCombo("", sort_placement[cfg.sort_placement])) {
+                for (int i = 0; i < IM_ARRAYSIZE(sort_placement); i++) {
+                    const bool is_selected = (cfg.sort_placement == i);
+                    
+                    if (ImGui::Selectable(sort_placement[i], is_selected)) {
+                        cfg.sort_placement = i;
+                        Config::Save(cfg);
+                    }
+                        
+                    if (is_selected) {
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+
+                ImGui::EndCombo();
+            }
+            ImGui::PopItemWidth();
+            ImGui::PopID();
+            
+            ImGui::SameLine();
+            
             if (ImGui::RadioButton("Default", cfg.sort_mode == SortDefault)) {
                 cfg.sort_mode = SortDefault;
-                AppList::Get(entries);
+                AppList::Refresh(entries);
             }
             
             ImGui::SameLine();
             
             if (ImGui::RadioButton("Asc", cfg.sort_mode == SortAsc)) {
                 cfg.sort_mode = SortAsc;
-                AppList::Get(entries);
-                std::sort(entries.icons.begin(), entries.icons.end(), AppList::SortAppAsc);
-                std::sort(entries.child_apps.begin(), entries.child_apps.end(), AppList::SortChildAppAsc);
-                AppList::Sort(entries);
+                AppList::Refresh(entries);
+                AppList::Order(entries, SortAsc);
+                Tabs::Place(entries);
             }
             
             ImGui::SameLine();
             
             if (ImGui::RadioButton("Desc", cfg.sort_mode == SortDesc)) {
                 cfg.sort_mode = SortDesc;
-                AppList::Get(entries);
-                std::sort(entries.icons.begin(), entries.icons.end(), AppList::SortAppDesc);
-                std::sort(entries.child_apps.begin(), entries.child_apps.end(), AppList::SortChildAppDesc);
-                AppList::Sort(entries);
+                AppList::Refresh(entries);
+                AppList::Order(entries, SortDesc);
+                Tabs::Place(entries);
             }
             
             ImGui::SameLine();
@@ -115,8 +146,10 @@ namespace Tabs {
                 ImGui::TableSetupColumn("Pos", ImGuiTableColumnFlags_WidthFixed);
                 ImGui::TableHeadersRow();
                 
-                for (unsigned int i = 0, counter = 0; i < entries.icons.size(); i++) {
-                    if (entries.icons[i].icon0Type == 7) {
+                for (unsigned int k = 0, counter = 0; k < entries.order.size(); k++) {
+                    const uint32_t i = entries.order[k];
+
+                    if (entries.icon0Type[i] == 7) {
                         ImGui::TableNextRow();
                         
                         ImGui::TableNextColumn();
@@ -124,38 +157,40 @@ namespace Tabs {
                         
                         ImGui::TableNextColumn();
                         std::string title = std::to_string(counter) + ") ";
-                        title.append(entries.icons[i].title);
+                        title.append(entries.Title(i));
                         bool open = ImGui::TreeNodeEx(title.c_str(), ImGuiTreeNodeFlags_SpanFullWidth);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pageId);
+                        ImGui::Text("%d", entries.pageId[i]);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pageNo);
+                        ImGui::Text("%d", entries.pageNo[i]);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pos);
+                        ImGui::Text("%d", entries.pos[i]);
                         
                         if (open) {
                             ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_Bullet | ImGuiTreeNodeFlags_NoTreePushOnOpen | ImGuiTreeNodeFlags_SpanFullWidth;
-                            int reserved01 = std::stoi(std::string(entries.icons[i].reserved01));
-                            
-                            for (unsigned int j = 0; j < entries.child_apps.size(); j++) {
-                                if (entries.child_apps[j].pageNo == reserved01) {
+                            if (entries.folder[i] >= 0) {
+                                const AppInfoFolder &folder = entries.folders[entries.folder[i]];
+
+                                for (uint32_t j = folder.begin; j < folder.end; j++) {
+                                    const uint32_t child = entries.children[j];
+
                                     ImGui::TableNextRow();
                                     ImGui::TableNextColumn();
                                     
                                     ImGui::TableNextColumn();
-                                    ImGui::TreeNodeEx(entries.child_apps[j].title, flags);
+                                    ImGui::TreeNodeEx(entries.Title(child), flags);
                                     
                                     ImGui::TableNextColumn();
-                                    ImGui::Text("%d", entries.child_apps[j].pageId);
+                                    ImGui::Text("%d", entries.pageId[child]);
                                     
                                     ImGui::TableNextColumn();
                                     ImGui::Text("-");
                                     
                                     ImGui::TableNextColumn();
-                                    ImGui::Text("%d", entries.child_apps[j].pos);
+                                    ImGui::Text("%d", entries.pos[child]);
                                 }
                             }
                             
@@ -164,7 +199,7 @@ namespace Tabs {
 
                         counter++;
                     }
-                    else if (entries.icons[i].pageNo >= 0) {
+                    else if (entries.pageNo[i] >= 0) {
                         ImGui::TableNextRow();
                         
                         ImGui::TableNextColumn();
@@ -172,17 +207,17 @@ namespace Tabs {
                         
                         ImGui::TableNextColumn();
                         std::string title = std::to_string(counter) + ") ";
-                        title.append(entries.icons[i].title);
+                        title.append(entries.Title(i));
                         ImGui::Selectable(title.c_str(), false, ImGuiSelectableFlags_SpanAllColumns);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pageId);
+                        ImGui::Text("%d", entries.pageId[i]);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pageNo);
+                        ImGui::Text("%d", entries.pageNo[i]);
                         
                         ImGui::TableNextColumn();
-                        ImGui::Text("%d", entries.icons[i].pos);
+                        ImGui::Text("%d", entries.pos[i]);
                         
                         counter++;
                     }